@@ -0,0 +1,689 @@
+#include <gtest.hh>
+
+#include <dolfin.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "CachedAssembly.h"
+#include "ColoredAssembly.h"
+#include "CongruentCells.h"
+#include "GeometryCache.h"
+#include "IntegralTimings.h"
+#include "L2Functional.h"
+#include "LinearHeat.h"
+#include "LinearHeatKernels.h"
+#include "LinearHeatOperator.h"
+#include "PreallocatedMatrices.h"
+#include "QuadraticL2Functional.h"
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace Spacy;
+
+namespace
+{
+    const auto mesh = std::make_shared<dolfin::UnitSquareMesh>(4, 3);
+    const auto V = std::make_shared<LinearHeat::FunctionSpace>(mesh);
+
+    std::shared_ptr<dolfin::Function> test_function(double scale)
+    {
+        auto f = std::make_shared<dolfin::Function>(V);
+        std::vector<double> values(V->dim());
+        for(auto i=0u; i<values.size(); ++i)
+            values[i] = scale*std::sin(1.+i);
+        f->vector()->set_local(values);
+        f->vector()->apply("insert");
+        return f;
+    }
+
+    std::vector<FEniCS::InstructionSet> instructionSets()
+    {
+        std::vector<FEniCS::InstructionSet> result = {FEniCS::InstructionSet::Generic};
+        if( FEniCS::bestInstructionSet() != FEniCS::InstructionSet::Generic )
+            result.push_back(FEniCS::bestInstructionSet());
+        return result;
+    }
+
+    /// Assembler whose assembly always fails.
+    struct ThrowingAssembler
+    {
+        template <class Form>
+        void assemble(dolfin::GenericMatrix&, const Form&)
+        {
+            throw std::runtime_error("ThrowingAssembler: assembly failed.");
+        }
+
+        bool add_values = true;
+    };
+
+    bool bitwiseEqual(double a, double b)
+    {
+        return std::memcmp(&a, &b, sizeof(double)) == 0;
+    }
+
+    /// Calls check(value, expectedValue) for all entries of A after checking that A has the sparsity pattern of expected.
+    template <class Check>
+    void compareMatrices(const dolfin::GenericMatrix& A, const dolfin::GenericMatrix& expected, const Check& check)
+    {
+        ASSERT_EQ( A.size(0), expected.size(0) );
+        std::vector<std::size_t> columns, expectedColumns;
+        std::vector<double> values, expectedValues;
+        for(auto i=0u; i<A.size(0); ++i)
+        {
+            A.getrow(i, columns, values);
+            expected.getrow(i, expectedColumns, expectedValues);
+            EXPECT_EQ( columns, expectedColumns );
+            ASSERT_EQ( values.size(), expectedValues.size() );
+            for(auto k=0u; k<values.size(); ++k)
+                check(values[k], expectedValues[k]);
+        }
+    }
+
+    /// Expects equal entries up to the given absolute tolerance, or up to four ulps if tolerance is zero.
+    void expectEqualMatrices(const dolfin::GenericMatrix& A, const dolfin::GenericMatrix& expected, double tolerance = 0)
+    {
+        compareMatrices(A, expected, [tolerance](double value, double expectedValue)
+        {
+            if( tolerance == 0 )
+                EXPECT_DOUBLE_EQ( value, expectedValue );
+            else
+                EXPECT_NEAR( value, expectedValue, tolerance );
+        });
+    }
+
+    void expectBitwiseEqualMatrices(const dolfin::GenericMatrix& A, const dolfin::GenericMatrix& expected)
+    {
+        compareMatrices(A, expected, [](double value, double expectedValue)
+        {
+            EXPECT_TRUE( bitwiseEqual(value, expectedValue) );
+        });
+    }
+}
+
+TEST(FEniCSAssembly,BatchedKernelsAreBitCompatible)
+{
+    constexpr auto n = 37;
+    std::vector<double> coordinates(6*n), f(3*n), x(3*n);
+    for(auto c=0; c<n; ++c)
+    {
+        for(auto k=0; k<6; ++k)
+            coordinates[k*n + c] = std::cos(0.3*c + k) + (k%2 == 0 ? k : 0);
+        for(auto k=0; k<3; ++k)
+        {
+            f[k*n + c] = std::sin(0.7*c + k);
+            x[k*n + c] = std::exp(-0.1*c) + k;
+        }
+    }
+
+    linearheat_cell_integral_0_otherwise F;
+    linearheat_cell_integral_1_otherwise J;
+    for(auto instructionSet : instructionSets())
+    {
+        std::vector<double> AF(3*n), AJ(9*n);
+        FEniCS::LinearHeatKernels::tabulateF(AF.data(), f.data(), x.data(), coordinates.data(), n, instructionSet);
+        FEniCS::LinearHeatKernels::tabulateJ(AJ.data(), coordinates.data(), n, instructionSet);
+        std::vector<double> G(3*n), AG(9*n);
+        FEniCS::LinearHeatKernels::tabulateJFactors(G.data(), coordinates.data(), n, instructionSet);
+        FEniCS::LinearHeatKernels::tabulateJFromFactors(AG.data(), G.data(), n, instructionSet);
+        std::vector<double> AFFused(3*n), AJFused(9*n);
+        FEniCS::LinearHeatKernels::tabulateFJ(AFFused.data(), AJFused.data(), f.data(), x.data(), coordinates.data(), n, instructionSet);
+
+        for(auto c=0; c<n; ++c)
+        {
+            double cellCoordinates[6], cellF[3], cellX[3], AFe[3] = {}, AJe[9] = {};
+            for(auto k=0; k<6; ++k)
+                cellCoordinates[k] = coordinates[k*n + c];
+            for(auto k=0; k<3; ++k)
+            {
+                cellF[k] = f[k*n + c];
+                cellX[k] = x[k*n + c];
+            }
+            const double* w[2] = {cellF, cellX};
+            F.tabulate_tensor(AFe, w, cellCoordinates, 0);
+            J.tabulate_tensor(AJe, nullptr, cellCoordinates, 0);
+
+            for(auto i=0; i<3; ++i)
+            {
+                EXPECT_TRUE( bitwiseEqual(AF[i*n + c], AFe[i]) );
+                EXPECT_TRUE( bitwiseEqual(AFFused[i*n + c], AFe[i]) );
+            }
+            for(auto i=0; i<9; ++i)
+            {
+                EXPECT_TRUE( bitwiseEqual(AJ[i*n + c], AJe[i]) );
+                EXPECT_TRUE( bitwiseEqual(AG[i*n + c], AJe[i]) );
+                EXPECT_TRUE( bitwiseEqual(AJFused[i*n + c], AJe[i]) );
+            }
+        }
+    }
+}
+
+TEST(FEniCSAssembly,BatchedAssemblyOfResidual)
+{
+    LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    dolfin::PETScVector expected, b;
+
+    dolfin::assemble(expected, F);
+    FEniCS::LinearHeatKernels::Assembler(5).assemble(b, F);
+
+    ASSERT_EQ( b.size(), expected.size() );
+    for(auto i=0u; i<b.size(); ++i)
+        EXPECT_DOUBLE_EQ( b[i], expected[i] );
+}
+
+TEST(FEniCSAssembly,BatchedAssemblyOfJacobian)
+{
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScMatrix expected, A;
+
+    dolfin::assemble(expected, J);
+    FEniCS::LinearHeatKernels::Assembler(5).assemble(A, J);
+
+    expectEqualMatrices(A, expected);
+}
+
+TEST(FEniCSAssembly,FusedAssemblyOfResidualAndJacobian)
+{
+    LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScVector expectedB;
+    dolfin::PETScMatrix expectedA;
+    dolfin::assemble(expectedB, F);
+    dolfin::assemble(expectedA, J);
+
+    for(auto reuseCongruentCells : {false, true})
+    {
+        dolfin::PETScVector b;
+        dolfin::PETScMatrix A;
+        FEniCS::LinearHeatKernels::Assembler(5, reuseCongruentCells).assemble(b, A, F, J);
+
+        ASSERT_EQ( b.size(), expectedB.size() );
+        for(auto i=0u; i<b.size(); ++i)
+            EXPECT_DOUBLE_EQ( b[i], expectedB[i] );
+
+        expectEqualMatrices(A, expectedA, 1e-12);
+    }
+}
+
+TEST(FEniCSAssembly,MatrixFreeJacobian)
+{
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScMatrix A;
+    dolfin::assemble(A, J);
+    const auto v = test_function(1.);
+    auto expected = test_function(0.);
+    A.mult(*v->vector(), *expected->vector());
+
+    const auto X = FEniCS::makeHilbertSpace(V);
+    for(auto cacheGeometry : {true, false})
+    {
+        const FEniCS::LinearHeatKernels::JacobianOperator op(J, X, X, cacheGeometry, 5);
+        EXPECT_EQ( op.memoryUsage() > 0, cacheGeometry );
+
+        auto y = test_function(3.);
+        op.apply(*v->vector(), *y->vector());
+        for(auto i=0u; i<V->dim(); ++i)
+            EXPECT_NEAR( (*y->vector())[i], (*expected->vector())[i], 1e-12 );
+    }
+}
+
+TEST(FEniCSAssembly,MatrixFreeJacobianOnSpacyVectors)
+{
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScMatrix A;
+    dolfin::assemble(A, J);
+    const auto X = FEniCS::makeHilbertSpace(V);
+    const FEniCS::LinearHeatKernels::JacobianOperator op(J, X, X);
+
+    auto x = zero(X);
+    cast_ref<FEniCS::Vector>(x) = *test_function(1.);
+    const auto y = op(x);
+
+    auto expected = test_function(0.);
+    A.mult(cast_ref<FEniCS::Vector>(x).get(), *expected->vector());
+    const auto& y_ = cast_ref<FEniCS::Vector>(y).get();
+    ASSERT_EQ( y_.size(), V->dim() );
+    for(auto i=0u; i<V->dim(); ++i)
+        EXPECT_NEAR( y_[i], (*expected->vector())[i], 1e-12 );
+}
+
+TEST(FEniCSAssembly,CoefficientDependencies)
+{
+    const LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    const LinearHeat::Form_J J(V, V);
+
+    EXPECT_EQ( FEniCS::coefficientDependencies(F), std::vector<std::size_t>({0, 1}) );
+    EXPECT_TRUE( FEniCS::coefficientDependencies(J).empty() );
+}
+
+TEST(FEniCSAssembly,CachedAssemblyTracksCoefficients)
+{
+    const auto x = test_function(2.);
+    const auto F = std::make_shared<LinearHeat::Form_F>(V, test_function(1.), x);
+    FEniCS::CachedAssembly<dolfin::PETScVector> residual(F);
+    EXPECT_FALSE( residual.isUpToDate() );
+
+    residual.get();
+    residual.get();
+    EXPECT_TRUE( residual.isUpToDate() );
+    EXPECT_EQ( residual.numberOfAssemblies(), 1u );
+
+    x->vector()->set_local(std::vector<double>(V->dim(), 1.));
+    x->vector()->apply("insert");
+    EXPECT_FALSE( residual.isUpToDate() );
+    residual.get();
+    EXPECT_EQ( residual.numberOfAssemblies(), 2u );
+
+    F->set_coefficient(0, std::make_shared<dolfin::Constant>(3.));
+    residual.get();
+    residual.get();
+    EXPECT_EQ( residual.numberOfAssemblies(), 3u );
+
+    residual.invalidate();
+    residual.get();
+    EXPECT_EQ( residual.numberOfAssemblies(), 4u );
+}
+
+TEST(FEniCSAssembly,JacobianIsAssembledOnceInNewtonIteration)
+{
+    const auto x = test_function(2.);
+    FEniCS::CachedAssembly<dolfin::PETScVector> residual(std::make_shared<LinearHeat::Form_F>(V, test_function(1.), x));
+    FEniCS::CachedAssembly<dolfin::PETScMatrix> jacobian(std::make_shared<LinearHeat::Form_J>(V, V));
+
+    // inexact Newton steps with the diagonal of J
+    const auto numberOfSteps = 5u;
+    const auto diagonal = test_function(0.)->vector();
+    std::vector<double> r, d, values;
+    for(auto step=0u; step<numberOfSteps; ++step)
+    {
+        residual.get().get_local(r);
+        jacobian.get().get_diagonal(*diagonal);
+        diagonal->get_local(d);
+        x->vector()->get_local(values);
+        for(auto i=0u; i<values.size(); ++i)
+            values[i] -= r[i]/d[i];
+        x->vector()->set_local(values);
+        x->vector()->apply("insert");
+    }
+
+    EXPECT_EQ( residual.numberOfAssemblies(), numberOfSteps );
+    EXPECT_EQ( jacobian.numberOfAssemblies(), 1u );
+}
+
+TEST(FEniCSAssembly,AffineGeometry)
+{
+    const FEniCS::AffineGeometry geometry(*mesh);
+    ASSERT_EQ( geometry.numberOfCells(), mesh->num_cells() );
+    EXPECT_EQ( geometry.memoryUsage(), 5*mesh->num_cells()*sizeof(double) );
+    EXPECT_TRUE( geometry.isGeometryOf(*mesh) );
+    EXPECT_FALSE( geometry.isGeometryOf(dolfin::UnitSquareMesh(2, 2)) );
+
+    std::vector<double> coordinates;
+    FEniCS::Detail::fillCoordinates(*mesh, 0, mesh->num_cells(), coordinates);
+    const auto n = mesh->num_cells();
+    for(auto c=0u; c<n; ++c)
+    {
+        const double J[2][2] = { { coordinates[2*n + c] - coordinates[c], coordinates[4*n + c] - coordinates[c] },
+                                 { coordinates[3*n + c] - coordinates[n + c], coordinates[5*n + c] - coordinates[n + c] } };
+        EXPECT_DOUBLE_EQ( geometry.detJ(c), J[0][0]*J[1][1] - J[0][1]*J[1][0] );
+        for(auto i=0u; i<2; ++i)
+            for(auto j=0u; j<2; ++j)
+                EXPECT_NEAR( geometry.K(c, i, 0)*J[0][j] + geometry.K(c, i, 1)*J[1][j], i == j ? 1. : 0., 1e-12 );
+    }
+
+    const std::vector<std::size_t> cells = {7, 2};
+    std::vector<double> gathered;
+    FEniCS::Detail::fillCoordinates(*mesh, 0, cells.size(), gathered, cells.data());
+    for(auto c=0u; c<cells.size(); ++c)
+        for(auto k=0u; k<6; ++k)
+            EXPECT_EQ( gathered[k*cells.size() + c], coordinates[k*n + cells[c]] );
+}
+
+TEST(FEniCSAssembly,AssemblyWithGivenGeometry)
+{
+    LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScVector expectedB, b;
+    dolfin::PETScMatrix expectedA, A;
+    FEniCS::LinearHeatKernels::Assembler().assemble(expectedB, expectedA, F, J);
+
+    FEniCS::LinearHeatKernels::Assembler assembler(std::make_shared<FEniCS::AffineGeometry>(*mesh), 5);
+    assembler.assemble(b, A, F, J);
+    for(auto i=0u; i<b.size(); ++i)
+        EXPECT_TRUE( bitwiseEqual(b[i], expectedB[i]) );
+
+    const auto otherMesh = std::make_shared<dolfin::UnitSquareMesh>(2, 2);
+    FEniCS::LinearHeatKernels::Assembler wrongGeometry(std::make_shared<FEniCS::AffineGeometry>(*otherMesh));
+    EXPECT_THROW( wrongGeometry.assemble(b, F), std::invalid_argument );
+}
+
+TEST(FEniCSAssembly,KernelsWithCachedGeometryAreBitCompatible)
+{
+    const auto first = 5u, n = 7u;
+    std::vector<double> coordinates, f(3*n), x(3*n);
+    FEniCS::Detail::fillCoordinates(*mesh, first, n, coordinates);
+    for(auto c=0u; c<n; ++c)
+        for(auto k=0u; k<3; ++k)
+        {
+            f[k*n + c] = std::sin(0.7*c + k);
+            x[k*n + c] = std::exp(-0.1*c) + k;
+        }
+
+    const FEniCS::AffineGeometry geometry(*mesh);
+    for(auto instructionSet : instructionSets())
+    {
+        std::vector<double> AF(3*n), AJ(9*n), AFGeometry(3*n), AJGeometry(9*n);
+        FEniCS::LinearHeatKernels::tabulateF(AF.data(), f.data(), x.data(), coordinates.data(), n, instructionSet);
+        FEniCS::LinearHeatKernels::tabulateJ(AJ.data(), coordinates.data(), n, instructionSet);
+        FEniCS::LinearHeatKernels::tabulateF(AFGeometry.data(), f.data(), x.data(), geometry, first, n, instructionSet);
+        FEniCS::LinearHeatKernels::tabulateJ(AJGeometry.data(), geometry, first, n, instructionSet);
+
+        for(auto i=0u; i<AF.size(); ++i)
+            EXPECT_TRUE( bitwiseEqual(AFGeometry[i], AF[i]) );
+        for(auto i=0u; i<AJ.size(); ++i)
+            EXPECT_TRUE( bitwiseEqual(AJGeometry[i], AJ[i]) );
+    }
+}
+
+TEST(FEniCSAssembly,CongruentCellsOfStructuredMesh)
+{
+    const FEniCS::CongruentCells classes(*mesh);
+    ASSERT_EQ( classes.numberOfClasses(), 2u );
+    for(auto k=0u; k<classes.numberOfClasses(); ++k)
+        EXPECT_EQ( classes.classOf(classes.representative(k)), k );
+
+    const FEniCS::AffineGeometry geometry(*mesh);
+    for(auto cell=0u; cell<mesh->num_cells(); ++cell)
+    {
+        const auto representative = classes.representative(classes.classOf(cell));
+        EXPECT_NEAR( geometry.detJ(cell), geometry.detJ(representative), 1e-12 );
+        for(auto i=0u; i<2; ++i)
+            for(auto j=0u; j<2; ++j)
+                EXPECT_NEAR( geometry.K(cell, i, j), geometry.K(representative, i, j), 1e-10 );
+    }
+}
+
+TEST(FEniCSAssembly,AssemblyOfJacobianWithCongruentCells)
+{
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScMatrix expected, A;
+
+    dolfin::assemble(expected, J);
+    FEniCS::LinearHeatKernels::Assembler assembler(std::make_shared<FEniCS::AffineGeometry>(*mesh), 256, true);
+    for(auto assembly=0; assembly<2; ++assembly)
+    {
+        if( assembly == 0 )
+            FEniCS::LinearHeatKernels::Assembler(256, true).assemble(A, J);
+        else
+            assembler.assemble(A, J);
+
+        expectEqualMatrices(A, expected, 1e-12);
+    }
+}
+
+TEST(FEniCSAssembly,QuadraticL2FunctionalMatchesForm)
+{
+    const auto W = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto x = std::make_shared<dolfin::Function>(W);
+    std::vector<double> values(W->dim());
+    for(auto i=0u; i<values.size(); ++i)
+        values[i] = std::sin(1.+i);
+    x->vector()->set_local(values);
+    x->vector()->apply("insert");
+    L2Functional::Form_F F(mesh, x);
+
+    const FEniCS::QuadraticL2Functional f(*W);
+    auto workspace = f.workspace();
+    const auto expected = dolfin::assemble(F);
+    EXPECT_NEAR( f(*x->vector(), workspace), expected, 1e-12*std::abs(expected) );
+
+    std::vector<double> results(4);
+    std::vector<std::thread> threads;
+    for(auto k=0u; k<results.size(); ++k)
+        threads.emplace_back([&f,&x,&results,k]
+        {
+            auto threadWorkspace = f.workspace();
+            results[k] = f(*x->vector(), threadWorkspace);
+        });
+    for(auto& thread : threads)
+        thread.join();
+    for(auto result : results)
+        EXPECT_TRUE( bitwiseEqual(result, f(*x->vector(), workspace)) );
+
+    auto foreignWorkspace = FEniCS::QuadraticL2Functional::Workspace{};
+    EXPECT_THROW( f(*x->vector(), foreignWorkspace), std::invalid_argument );
+}
+
+TEST(FEniCSAssembly,QuadraticL2FunctionalDerivatives)
+{
+    const auto W = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto x = std::make_shared<dolfin::Function>(W);
+    const auto v = std::make_shared<dolfin::Function>(W);
+    std::vector<double> xValues(W->dim()), vValues(W->dim());
+    for(auto i=0u; i<W->dim(); ++i)
+    {
+        xValues[i] = std::sin(1.+i);
+        vValues[i] = std::cos(2.+i);
+    }
+    x->vector()->set_local(xValues);
+    x->vector()->apply("insert");
+    v->vector()->set_local(vValues);
+    v->vector()->apply("insert");
+
+    const FEniCS::QuadraticL2Functional f(*W);
+    auto workspace = f.workspace();
+    auto g = x->vector()->copy();
+    auto Hv = x->vector()->copy();
+    f.gradient(*x->vector(), *g, workspace);
+    f.hessian(*v->vector(), *Hv, workspace);
+
+    // f is quadratic, so x^T H x = 2 f(x), v^T g(x) = x^T H v, and f(x+v) = f(x) + v^T g(x) + f(v)
+    auto Hx = x->vector()->copy();
+    f.hessian(*x->vector(), *Hx, workspace);
+    EXPECT_NEAR( x->vector()->inner(*Hx), 2*f(*x->vector(), workspace), 1e-12 );
+    EXPECT_NEAR( v->vector()->inner(*g), x->vector()->inner(*Hv), 1e-12 );
+
+    auto xv = x->vector()->copy();
+    xv->axpy(1., *v->vector());
+    EXPECT_NEAR( f(*xv, workspace), f(*x->vector(), workspace) + v->vector()->inner(*g) + f(*v->vector(), workspace), 1e-12 );
+}
+
+TEST(FEniCSAssembly,CellColoringSeparatesCellsWithCommonDofs)
+{
+    FEniCS::ColoredAssembler assembler;
+    const auto& coloring = assembler.coloring(*V);
+    EXPECT_EQ( &coloring, &assembler.coloring(*V) );
+    EXPECT_GT( coloring.numberOfColors(), 1u );
+
+    std::size_t numberOfCells = 0;
+    for(auto k=0u; k<coloring.numberOfColors(); ++k)
+    {
+        std::vector<int> used(V->dim(), 0);
+        for(auto cell : coloring.cells(k))
+        {
+            EXPECT_EQ( coloring.colorOf(cell), k );
+            const auto dofs = V->dofmap()->cell_dofs(cell);
+            for(auto i=0; i<dofs.size(); ++i)
+                EXPECT_EQ( used[dofs[i]]++, 0 );
+        }
+        numberOfCells += coloring.cells(k).size();
+    }
+    EXPECT_EQ( numberOfCells, mesh->num_cells() );
+}
+
+TEST(FEniCSAssembly,ColoredAssemblyOfLinearHeat)
+{
+    LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    LinearHeat::Form_J J(V, V);
+    dolfin::PETScVector expectedB, serialB;
+    dolfin::PETScMatrix expectedA;
+    dolfin::assemble(expectedB, F);
+    dolfin::assemble(expectedA, J);
+    FEniCS::ColoredAssembler(1, 3).assemble(serialB, F);
+
+    for(auto numberOfThreads : {1u, 2u, 4u})
+    {
+        dolfin::PETScVector b;
+        dolfin::PETScMatrix A;
+        FEniCS::ColoredAssembler(numberOfThreads, 3).assemble(b, F);
+        FEniCS::ColoredAssembler(numberOfThreads, 3).assemble(A, J);
+
+        ASSERT_EQ( b.size(), expectedB.size() );
+        for(auto i=0u; i<b.size(); ++i)
+        {
+            EXPECT_NEAR( b[i], expectedB[i], 1e-12 );
+            EXPECT_TRUE( bitwiseEqual(b[i], serialB[i]) );
+        }
+
+        // matrices are added in cell order, like with dolfin::Assembler
+        expectBitwiseEqualMatrices(A, expectedA);
+    }
+}
+
+TEST(FEniCSAssembly,ColoredAssemblyOfL2Functional)
+{
+    const auto W = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto x = std::make_shared<dolfin::Function>(W);
+    std::vector<double> values(W->dim());
+    for(auto i=0u; i<values.size(); ++i)
+        values[i] = std::sin(1.+i);
+    x->vector()->set_local(values);
+    x->vector()->apply("insert");
+    L2Functional::Form_F F(mesh, x);
+
+    const auto expected = dolfin::assemble(F);
+    const auto serial = FEniCS::ColoredAssembler(1, 5).assemble(F);
+    EXPECT_NEAR( serial, expected, 1e-12*std::abs(expected) );
+    for(auto numberOfThreads : {2u, 4u})
+        EXPECT_TRUE( bitwiseEqual(FEniCS::ColoredAssembler(numberOfThreads, 5).assemble(F), serial) );
+}
+
+TEST(FEniCSAssembly,IntegralTimingsCountCellsOfGeneratedForms)
+{
+    const auto W = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto x = std::make_shared<dolfin::Function>(W);
+    LinearHeat::Form_F F(V, test_function(1.), test_function(2.));
+    LinearHeat::Form_J J(V, V);
+    L2Functional::Form_F L2(mesh, x);
+    const auto timedF = FEniCS::timed(F, "LinearHeat.F");
+    const auto timedJ = FEniCS::timed(J, "LinearHeat.J");
+    const auto timedL2 = FEniCS::timed(L2, "L2Functional.F");
+
+    auto& timings = FEniCS::IntegralTimings::instance();
+    auto& timerF = timings.timer("LinearHeat.F/cell_integral_otherwise");
+    auto& timerJ = timings.timer("LinearHeat.J/cell_integral_otherwise");
+    auto& timerL2 = timings.timer("L2Functional.F/cell_integral_otherwise");
+    timings.reset();
+
+    // disabled timers do not count
+    dolfin::PETScVector b;
+    dolfin::assemble(b, *timedF);
+    EXPECT_EQ( timerF.calls(), 0u );
+
+    timings.enable();
+    dolfin::PETScVector expectedB;
+    dolfin::PETScMatrix A, expectedA;
+    dolfin::assemble(b, *timedF);
+    dolfin::assemble(A, *timedJ);
+    dolfin::assemble(A, *timedJ);
+    const auto value = dolfin::assemble(*timedL2);
+    timings.enable(false);
+
+    dolfin::assemble(expectedB, F);
+    dolfin::assemble(expectedA, J);
+    for(auto i=0u; i<b.size(); ++i)
+        EXPECT_TRUE( bitwiseEqual(b[i], expectedB[i]) );
+    EXPECT_TRUE( bitwiseEqual(value, dolfin::assemble(L2)) );
+
+    EXPECT_EQ( timerF.calls(), mesh->num_cells() );
+    EXPECT_EQ( timerJ.calls(), 2*mesh->num_cells() );
+    EXPECT_EQ( timerL2.calls(), mesh->num_cells() );
+    for(const auto* timer : {&timerF, &timerJ, &timerL2})
+    {
+        EXPECT_GE( timer->totalSeconds(), 0. );
+        EXPECT_LE( timer->percentile(0.5), timer->percentile(0.99) );
+        EXPECT_LE( timer->percentile(0.99), timer->percentile(1.) );
+        EXPECT_GT( timer->percentile(1.), 0. );
+    }
+
+    std::ostringstream json;
+    timings.writeJson(json);
+    const auto entryJ = "\"name\": \"LinearHeat.J/cell_integral_otherwise\", \"calls\": " + std::to_string(2*mesh->num_cells());
+    EXPECT_NE( json.str().find(entryJ), std::string::npos );
+}
+
+TEST(FEniCSAssembly,IntegralTimingsEscapeNamesAndKeepSubdomains)
+{
+    LinearHeat::Form_J J(V, V);
+    const auto domains = std::make_shared<dolfin::MeshFunction<std::size_t>>(mesh, 2, 0);
+    J.set_cell_domains(domains);
+    const auto timedJ = FEniCS::timed(J, "quoted \"J\"\\\n");
+    EXPECT_EQ( timedJ->cell_domains(), domains );
+
+    auto& timings = FEniCS::IntegralTimings::instance();
+    auto& timer = timings.timer("quoted \"J\"\\\n/cell_integral_otherwise");
+    timings.reset();
+    timings.recordTrace(true, 1);
+    timings.enable();
+    dolfin::PETScMatrix A;
+    dolfin::assemble(A, *timedJ);
+    timings.enable(false);
+    timings.recordTrace(false);
+    EXPECT_EQ( timer.calls(), mesh->num_cells() );
+    EXPECT_EQ( timer.traceEvents().size(), 1u );
+
+    std::ostringstream json, trace;
+    timings.writeJson(json);
+    timings.writeChromeTrace(trace);
+    const std::string escaped = "quoted \\\"J\\\"\\\\\\u000a/cell_integral_otherwise";
+    EXPECT_NE( json.str().find("\"name\": \"" + escaped + "\""), std::string::npos );
+    EXPECT_NE( trace.str().find("\"name\":\"" + escaped + "\""), std::string::npos );
+}
+
+TEST(FEniCSAssembly,PreallocatedMatrixIsReusedAcrossAssemblies)
+{
+    dolfin::PETScMatrix expected;
+    dolfin::assemble(expected, LinearHeat::Form_J(V, V));
+
+    FEniCS::PreallocatedMatrices matrices;
+    FEniCS::LinearHeatKernels::Assembler batchedAssembler;
+    std::shared_ptr<dolfin::PETScMatrix> A;
+    for(auto step=0; step<3; ++step)
+    {
+        // a new form per time step maps to the same preallocated matrix
+        LinearHeat::Form_J J(V, V);
+        const auto previous = A;
+        A = step == 1 ? matrices.assemble(J, batchedAssembler) : matrices.assemble(J);
+        if( previous )
+        {
+            EXPECT_EQ( A, previous );
+        }
+        EXPECT_EQ( matrices.size(), 1u );
+
+        expectEqualMatrices(*A, expected);
+    }
+    EXPECT_FALSE( batchedAssembler.add_values );
+
+    const auto otherMesh = std::make_shared<dolfin::UnitSquareMesh>(2, 2);
+    const auto W = std::make_shared<LinearHeat::FunctionSpace>(otherMesh);
+    EXPECT_NE( matrices.assemble(LinearHeat::Form_J(W, W)), A );
+    EXPECT_EQ( matrices.size(), 2u );
+    matrices.clear();
+    EXPECT_EQ( matrices.size(), 0u );
+}
+
+TEST(FEniCSAssembly,PreallocatedMatrixAssemblyRestoresAddValuesOnFailure)
+{
+    FEniCS::PreallocatedMatrices matrices;
+    ThrowingAssembler assembler;
+    EXPECT_THROW( matrices.assemble(LinearHeat::Form_J(V, V), assembler), std::runtime_error );
+    EXPECT_TRUE( assembler.add_values );
+}
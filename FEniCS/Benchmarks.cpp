@@ -0,0 +1,654 @@
+#include <gtest.hh>
+
+#include <dolfin.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Copy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "Comparison.h"
+#include "ColoredAssembly.h"
+#include "CopyPlan.h"
+#include "Dofmap.h"
+#include "GeometryCache.h"
+#include "DualPairings.h"
+#include "L2Functional.h"
+#include "LinearCombination.h"
+#include "LinearHeat.h"
+#include "LinearHeatKernels.h"
+#include "LinearHeatOperator.h"
+#include "LocalArray.h"
+#include "Parallel.h"
+#include "QuadraticL2Functional.h"
+#include "Renumbering.h"
+#include "SmallVector.h"
+#include "VectorPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace Spacy;
+
+// Timing harness for the optimized code paths: each test checks that both paths agree and reports the best of a few
+// runs of the reference and the optimized path, on stdout and as gtest properties. Timings are not asserted, as they
+// depend on the machine. The mesh has SPACY_FENICS_BENCHMARK_SIZE x SPACY_FENICS_BENCHMARK_SIZE squares (default 64),
+// sweeps over vector sizes stop at SPACY_FENICS_BENCHMARK_MAX_DOFS (default 1e7).
+namespace
+{
+    std::size_t fromEnvironment(const char* name, std::size_t defaultValue)
+    {
+        const auto* value = std::getenv(name);
+        return value ? std::max(std::atol(value), 1l) : defaultValue;
+    }
+
+    std::size_t benchmarkSize()
+    {
+        return fromEnvironment("SPACY_FENICS_BENCHMARK_SIZE", 64);
+    }
+
+    std::size_t maximalNumberOfDofs()
+    {
+        return fromEnvironment("SPACY_FENICS_BENCHMARK_MAX_DOFS", 10000000);
+    }
+
+    const auto mesh = std::make_shared<dolfin::UnitSquareMesh>(benchmarkSize(), benchmarkSize());
+    const auto dolfin_W = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto W = Spacy::FEniCS::makeHilbertSpace(dolfin_W, {0,1,2}, {});
+    const auto dolfin_V = std::make_shared<LinearHeat::FunctionSpace>(mesh);
+    const auto V = Spacy::FEniCS::makeHilbertSpace(dolfin_V);
+
+    /// Best wall-clock time in seconds of repetitions calls of f, after one warm-up call.
+    template <class F>
+    double seconds(const F& f, int repetitions = 5)
+    {
+        f();
+        auto best = std::numeric_limits<double>::max();
+        for(auto i=0; i<repetitions; ++i)
+        {
+            const auto start = std::chrono::steady_clock::now();
+            f();
+            best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+        return best;
+    }
+
+    void report(const std::string& what, double reference, double optimized)
+    {
+        std::cout << "[ TIMING   ] " << std::left << std::setw(44) << what << std::right << std::scientific << std::setprecision(3)
+                  << reference << " s -> " << optimized << " s, speedup " << std::fixed << std::setprecision(2)
+                  << reference/optimized << std::endl;
+        ::testing::Test::RecordProperty(what + " reference_s", std::to_string(reference));
+        ::testing::Test::RecordProperty(what + " optimized_s", std::to_string(optimized));
+    }
+
+    std::shared_ptr<dolfin::Function> test_function(const std::shared_ptr<const dolfin::FunctionSpace>& space, double scale)
+    {
+        auto f = std::make_shared<dolfin::Function>(space);
+        std::vector<double> values(f->vector()->local_size());
+        for(auto i=0u; i<values.size(); ++i)
+            values[i] = scale*std::sin(1.+i);
+        FEniCS::setLocal(*f->vector(), values);
+        return f;
+    }
+
+    ::Spacy::Vector test_vector(const VectorSpace& X, double scale, const std::shared_ptr<const dolfin::FunctionSpace>& space = dolfin_W)
+    {
+        auto x = zero(X);
+        FEniCS::copy(*test_function(space, scale), x);
+        return x;
+    }
+
+    double maxDifference(const dolfin::GenericVector& x, const dolfin::GenericVector& y)
+    {
+        auto dx = x.copy();
+        dx->axpy(-1, y);
+        return dx->norm("linf");
+    }
+
+    double maxDifference(const dolfin::GenericMatrix& A, const dolfin::GenericMatrix& B)
+    {
+        auto D = A.copy();
+        D->axpy(-1, B, true);
+        return D->norm("linf");
+    }
+
+    /// Bytes of the values, column indices and row offsets of A in compressed row storage, as used by PETSc's AIJ format.
+    std::size_t compressedRowStorage(const dolfin::GenericMatrix& A)
+    {
+        std::vector<std::size_t> columns;
+        std::vector<double> values;
+        std::size_t nonzeros = 0;
+        for(auto i=0u; i<A.size(0); ++i)
+        {
+            A.getrow(i, columns, values);
+            nonzeros += columns.size();
+        }
+        return nonzeros*(sizeof(PetscScalar) + sizeof(PetscInt)) + (A.size(0) + 1)*sizeof(PetscInt);
+    }
+}
+
+TEST(FEniCSBenchmark,SetLocal)
+{
+    for(std::size_t n = 1000; n <= maximalNumberOfDofs(); n *= 10)
+    {
+        dolfin::PETScVector x(MPI_COMM_WORLD, n);
+        std::vector<double> values(x.local_size());
+        for(auto i=0u; i<values.size(); ++i)
+            values[i] = i;
+
+        const auto reference = seconds([&]
+        {
+            for(auto i=0u; i<values.size(); ++i)
+                x.setitem(i, values[i]);
+            x.apply("insert");
+        });
+        const auto expected = x.copy();
+        x.zero();
+        const auto optimized = seconds([&] { FEniCS::setLocal(x, values); });
+
+        EXPECT_EQ( maxDifference(x, *expected), 0. );
+        report("setLocal vs. setitem, " + std::to_string(n) + " dofs", reference, optimized);
+    }
+}
+
+TEST(FEniCSBenchmark,CopyPlan)
+{
+    const auto x = test_vector(W, 1.);
+    auto f = dolfin::Function(dolfin_W), g = dolfin::Function(dolfin_W);
+    const FEniCS::CopyPlan plan(W, *dolfin_W);
+
+    const auto reference = seconds([&] { FEniCS::copy(x, *f.vector()); });
+    const auto optimized = seconds([&] { plan.copy(x, g); });
+    EXPECT_EQ( maxDifference(*f.vector(), *g.vector()), 0. );
+    report("CopyPlan::copy vs. FEniCS::copy", reference, optimized);
+
+    auto y = zero(W), z = zero(W);
+    const auto referenceBack = seconds([&] { FEniCS::copy(f, y); });
+    const auto optimizedBack = seconds([&] { plan.copy(g, z); });
+    EXPECT_EQ( y, z );
+    report("CopyPlan::copy vs. FEniCS::copy, to Spacy", referenceBack, optimizedBack);
+}
+
+TEST(FEniCSBenchmark,BatchedDofmap)
+{
+    // mixed space of L2Functional with about SPACY_FENICS_BENCHMARK_MAX_DOFS dofs
+    const auto n = std::max<std::size_t>(std::sqrt(maximalNumberOfDofs()/3.) - 1, 1);
+    const auto largeMesh = std::make_shared<dolfin::UnitSquareMesh>(n, n);
+    const auto X = Spacy::FEniCS::makeHilbertSpace(std::make_shared<L2Functional::CoefficientSpace_x>(largeMesh), {0,1,2}, {});
+    const auto& U = creator<FEniCS::VectorCreator>(creator<ProductSpace::VectorCreator>(X).subSpace(1));
+    const FEniCS::Dofmap dofmap(U);
+    const auto size = U.size();
+
+    std::vector<std::size_t> indices(size), expected(size), mapped(size), inverse(size);
+    std::iota(begin(indices), end(indices), 0);
+    const auto reference = seconds([&]
+    {
+        for(auto i=0u; i<size; ++i)
+            expected[i] = U.dofmap(indices[i]);
+    });
+    const auto optimized = seconds([&] { dofmap.dofmap(indices.data(), mapped.data(), size); });
+    EXPECT_EQ( mapped, expected );
+    report("batched dofmap, " + std::to_string(3*size) + " dofs", reference, optimized);
+
+    const auto referenceInverse = seconds([&]
+    {
+        for(auto i=0u; i<size; ++i)
+            expected[i] = U.inverseDofmap(mapped[i]);
+    });
+    const auto optimizedInverse = seconds([&] { dofmap.inverseDofmap(mapped.data(), inverse.data(), size); });
+    EXPECT_EQ( inverse, expected );
+    report("batched inverseDofmap, " + std::to_string(3*size) + " dofs", referenceInverse, optimizedInverse);
+
+    std::vector<double> from(size), to(3*size), expectedTo(3*size);
+    for(auto i=0u; i<size; ++i)
+        from[i] = std::sin(1.+i);
+    const auto referenceScatter = seconds([&]
+    {
+        for(auto i=0u; i<size; ++i)
+            expectedTo[U.dofmap(i)] = from[i];
+    });
+    const auto optimizedScatter = seconds([&] { dofmap.scatter(from.data(), to.data()); });
+    EXPECT_EQ( to, expectedTo );
+    report("Dofmap::scatter vs. per-entry dofmap", referenceScatter, optimizedScatter);
+}
+
+namespace
+{
+    /// graph with node k being the node ordering[k] of graph.
+    std::vector<std::vector<std::size_t>> renumbered(const std::vector<std::vector<std::size_t>>& graph, const std::vector<std::size_t>& ordering)
+    {
+        std::vector<std::size_t> position(ordering.size());
+        for(auto k=0u; k<ordering.size(); ++k)
+            position[ordering[k]] = k;
+
+        std::vector<std::vector<std::size_t>> result(graph.size());
+        for(auto k=0u; k<ordering.size(); ++k)
+        {
+            for(auto neighbour : graph[ordering[k]])
+                result[k].push_back(position[neighbour]);
+            std::sort(begin(result[k]), end(result[k]));
+        }
+        return result;
+    }
+
+    /// Graph Laplacian in compressed row format, as stand-in for operators assembled on the dofs of graph.
+    struct GraphLaplacian
+    {
+        explicit GraphLaplacian(const std::vector<std::vector<std::size_t>>& graph)
+        {
+            offsets.push_back(0);
+            for(auto node=0u; node<graph.size(); ++node)
+            {
+                columns.push_back(node);
+                values.push_back(graph[node].size());
+                for(auto neighbour : graph[node])
+                {
+                    columns.push_back(neighbour);
+                    values.push_back(-1);
+                }
+                offsets.push_back(columns.size());
+            }
+        }
+
+        void mult(const std::vector<double>& x, std::vector<double>& y) const
+        {
+            for(auto i=0u; i+1<offsets.size(); ++i)
+            {
+                auto sum = 0.;
+                for(auto k=offsets[i]; k<offsets[i+1]; ++k)
+                    sum += values[k]*x[columns[k]];
+                y[i] = sum;
+            }
+        }
+
+        std::vector<std::size_t> offsets, columns;
+        std::vector<double> values;
+    };
+}
+
+TEST(FEniCSBenchmark,ReverseCuthillMcKee)
+{
+    // dof numbering without locality, as produced by mesh generators, modelled by a random permutation
+    const auto largeMesh = std::make_shared<dolfin::UnitSquareMesh>(4*benchmarkSize(), 4*benchmarkSize());
+    const L2Functional::CoefficientSpace_x X(largeMesh);
+    const auto original = FEniCS::Detail::dofGraph(X);
+    std::vector<std::size_t> shuffle(original.size());
+    std::iota(begin(shuffle), end(shuffle), std::size_t(0));
+    std::shuffle(begin(shuffle), end(shuffle), std::mt19937(0));
+    const auto graph = renumbered(original, shuffle);
+    const auto ordering = FEniCS::reverseCuthillMcKee(graph);
+    const auto n = graph.size();
+
+    // SpMV with the dofs in the unordered and in the reverse Cuthill-McKee numbering
+    const GraphLaplacian A(graph), renumberedA(renumbered(graph, ordering));
+    std::vector<double> x(n), renumberedX(n), y(n), renumberedY(n), expected(n);
+    for(auto i=0u; i<n; ++i)
+        x[i] = std::sin(1.+i);
+    FEniCS::permute(ordering, x.data(), renumberedX.data());
+
+    const auto reference = seconds([&] { A.mult(x, y); });
+    const auto optimized = seconds([&] { renumberedA.mult(renumberedX, renumberedY); });
+    FEniCS::permute(ordering, y.data(), expected.data());
+    for(auto i=0u; i<n; ++i)
+        EXPECT_NEAR( renumberedY[i], expected[i], 1e-12*std::abs(expected[i]) + 1e-12 );
+    report("SpMV, reverse Cuthill-McKee vs. unordered", reference, optimized);
+
+    // copy of the first component, numbered by vertices, from the unordered and from the renumbered mixed vector
+    std::vector<std::size_t> position(n);
+    for(auto k=0u; k<n; ++k)
+        position[shuffle[k]] = k;
+    std::vector<std::size_t> table(n/3);
+    for(auto i=0u; i<table.size(); ++i)
+        table[i] = position[3*i];
+    const FEniCS::Dofmap dofmap(table);
+    const auto subOrdering = FEniCS::restrictOrdering(ordering, dofmap);
+    const auto renumberedDofmap = FEniCS::renumber(dofmap, subOrdering);
+    for(auto k=0u; k<n; ++k)
+        position[ordering[k]] = k;
+    for(auto i=0u; i<table.size(); ++i)
+        table[i] = position[renumberedDofmap.dofmap(i)];
+    const FEniCS::Dofmap rcmDofmap(table);
+
+    std::vector<double> component(table.size()), renumberedComponent(table.size()), expectedComponent(table.size());
+    const auto referenceCopy = seconds([&] { dofmap.gather(x.data(), component.data()); });
+    const auto optimizedCopy = seconds([&] { rcmDofmap.gather(renumberedX.data(), renumberedComponent.data()); });
+    FEniCS::permute(subOrdering, component.data(), expectedComponent.data());
+    EXPECT_EQ( renumberedComponent, expectedComponent );
+    report("copy, reverse Cuthill-McKee vs. unordered", referenceCopy, optimizedCopy);
+}
+
+TEST(FEniCSBenchmark,LazyCopyPlan)
+{
+    const auto x = test_vector(W, 1.);
+    auto f = dolfin::Function(dolfin_W), g = dolfin::Function(dolfin_W);
+
+    const auto eager = seconds([&] { FEniCS::CopyPlan(W, *dolfin_W).warmup(); });
+    const auto lazy = seconds([&] { FEniCS::CopyPlan plan(W, *dolfin_W); EXPECT_FALSE( plan.isInitialized() ); });
+    report("CopyPlan construction, lazy vs. eager", eager, lazy);
+
+    const auto eagerFirstCopy = seconds([&] { FEniCS::CopyPlan plan(W, *dolfin_W); plan.warmup(); plan.copy(x, f); });
+    const auto lazyFirstCopy = seconds([&] { FEniCS::CopyPlan(W, *dolfin_W).copy(x, g); });
+    EXPECT_EQ( maxDifference(*f.vector(), *g.vector()), 0. );
+    report("CopyPlan with first copy, lazy vs. eager", eagerFirstCopy, lazyFirstCopy);
+}
+
+TEST(FEniCSBenchmark,FusedLinearCombination)
+{
+    const auto x = test_vector(W, 1.), dx = test_vector(W, 2.), g = test_vector(W, 3.);
+    auto y = zero(W), z = zero(W);
+
+    const auto reference = seconds([&]
+    {
+        y = dx;
+        y *= 0.5;
+        y += x;
+        auto t = g;
+        t *= 2;
+        y -= t;
+    });
+    const auto optimized = seconds([&] { FEniCS::assign(z, FEniCS::term(x) + 0.5*FEniCS::term(dx) - 2*FEniCS::term(g)); });
+    EXPECT_EQ( y, z );
+    report("fused linear combination", reference, optimized);
+}
+
+// Counts heap allocations through operator new in this executable.
+namespace
+{
+    std::atomic<std::size_t> numberOfAllocations{0};
+}
+
+void* operator new(std::size_t size)
+{
+    ++numberOfAllocations;
+    if( auto* p = std::malloc(size) )
+        return p;
+    throw std::bad_alloc();
+}
+
+// not inlined, as gcc otherwise warns about std::free on memory from operator new
+[[gnu::noinline]] void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+TEST(FEniCSBenchmark,AllocationFreeComparison)
+{
+    const auto x = test_vector(W, 1.), y = test_vector(W, 1.);
+    auto expected = false, result = false;
+
+    auto allocations = numberOfAllocations.load();
+    const auto reference = seconds([&] { expected = x == y; });
+    const auto referenceAllocations = numberOfAllocations - allocations;
+    allocations = numberOfAllocations.load();
+    const auto optimized = seconds([&] { result = FEniCS::equal(x, y); });
+    const auto optimizedAllocations = numberOfAllocations - allocations;
+
+    EXPECT_TRUE( result );
+    EXPECT_EQ( result, expected );
+    EXPECT_EQ( optimizedAllocations, 0u );
+    report("FEniCS::equal vs. operator==", reference, optimized);
+    std::cout << "[ TIMING   ] heap allocations per comparison " << referenceAllocations/6. << " -> " << optimizedAllocations/6. << std::endl;
+}
+
+TEST(FEniCSBenchmark,BatchedDualPairings)
+{
+    const auto x = test_vector(W, 1.);
+    std::vector<::Spacy::Vector> ys;
+    for(auto k=0; k<20; ++k)
+        ys.push_back(test_vector(W, 2.+k));
+    std::vector<double> expected(ys.size()), pairings;
+
+    const auto reference = seconds([&]
+    {
+        for(auto k=0u; k<ys.size(); ++k)
+            expected[k] = get(x(ys[k]));
+    });
+    const auto optimized = seconds([&] { pairings = FEniCS::dualPairings(x, ys); });
+    for(auto k=0u; k<ys.size(); ++k)
+        EXPECT_NEAR( pairings[k], expected[k], 1e-12*std::abs(expected[k]) );
+    report("batched dual pairings, 20 vectors", reference, optimized);
+}
+
+TEST(FEniCSBenchmark,SmallVector)
+{
+    constexpr auto calls = 1000;
+    const auto smallMesh = std::make_shared<dolfin::UnitIntervalMesh>(MPI_COMM_WORLD, 7);
+    const auto X = Spacy::FEniCS::makeHilbertSpace(std::make_shared<LinearHeat::FunctionSpace>(smallMesh));
+    ASSERT_TRUE( FEniCS::fitsSmallVector<>(X) );
+    ::Spacy::Vector x = zero(X), y = zero(X);
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(x), std::vector<double>{1., 2., 3., 4., 5., 6., 7., 8.});
+    const FEniCS::SmallVector<> x_(cast_ref<FEniCS::Vector>(x));
+    FEniCS::SmallVector<> y_(X);
+
+    auto sum = 0., smallSum = 0.;
+    const auto referenceZero = seconds([&] { for(auto i=0; i<calls; ++i) sum += get(zero(X)(x)); });
+    const auto optimizedZero = seconds([&] { for(auto i=0; i<calls; ++i) smallSum += FEniCS::SmallVector<>(X)(x_); });
+    EXPECT_EQ( smallSum, sum );
+    report("SmallVector zero(V) + w(w), per call", referenceZero/calls, optimizedZero/calls);
+
+    const auto referenceAdd = seconds([&] { for(auto i=0; i<calls; ++i) y += x; });
+    const auto optimizedAdd = seconds([&] { for(auto i=0; i<calls; ++i) y_ += x_; });
+    EXPECT_EQ( FEniCS::SmallVector<>(cast_ref<FEniCS::Vector>(y))(x_), y_(x_) );
+    report("SmallVector +=, per call", referenceAdd/calls, optimizedAdd/calls);
+
+    const auto referenceDual = seconds([&] { for(auto i=0; i<calls; ++i) sum += get(x(x)); });
+    const auto optimizedDual = seconds([&] { for(auto i=0; i<calls; ++i) smallSum += x_(x_); });
+    EXPECT_EQ( smallSum, sum );
+    report("SmallVector w(w), per call", referenceDual/calls, optimizedDual/calls);
+}
+
+TEST(FEniCSBenchmark,VectorPool)
+{
+    // temporaries of a Newton iteration, two of them alive at a time
+    constexpr auto temporaries = 24;
+    const auto x = test_vector(W, 1.);
+    auto y = zero(W), z = zero(W);
+    FEniCS::VectorPool pool(W);
+
+    const auto iteration = [&]
+    {
+        for(auto k=0; k<temporaries/2; ++k)
+        {
+            auto s = zero(W), t = zero(W);
+            s += x;
+            t += s;
+            y += t;
+        }
+    };
+    const auto pooledIteration = [&]
+    {
+        for(auto k=0; k<temporaries/2; ++k)
+        {
+            auto s = pool.zero(), t = pool.zero();
+            s.get() += x;
+            t.get() += s.get();
+            z += t.get();
+        }
+    };
+    const auto reference = seconds(iteration);
+    const auto optimized = seconds(pooledIteration);
+    EXPECT_EQ( y, z );
+    report("VectorPool::zero vs. zero, per iteration", reference, optimized);
+
+    auto allocations = numberOfAllocations.load();
+    iteration();
+    const auto referenceAllocations = numberOfAllocations - allocations;
+    allocations = numberOfAllocations.load();
+    const auto misses = pool.misses();
+    pooledIteration();
+    const auto optimizedAllocations = numberOfAllocations - allocations;
+    EXPECT_EQ( pool.misses(), misses );
+    std::cout << "[ TIMING   ] per iteration: heap allocations " << referenceAllocations << " -> " << optimizedAllocations
+              << ", new vectors " << temporaries << " -> " << pool.misses() - misses << std::endl;
+}
+
+TEST(FEniCSBenchmark,ParallelComponentOperations)
+{
+    const auto largeMesh = std::make_shared<dolfin::UnitSquareMesh>(4*benchmarkSize(), 4*benchmarkSize());
+    const auto dolfin_X = std::make_shared<L2Functional::CoefficientSpace_x>(largeMesh);
+    const auto X = Spacy::FEniCS::makeHilbertSpace(dolfin_X, {0,1,2}, {});
+    const auto x = test_vector(X, 1., dolfin_X), z = test_vector(X, 2., dolfin_X);
+    ASSERT_GE( dolfin_X->dim(), FEniCS::minimumParallelWork() );
+
+    auto expected = x;
+    const auto reference = seconds([&] { FEniCS::axpy(expected, 0.5, z, 1); });
+    auto pairing = 0.;
+    const auto referencePairing = seconds([&] { pairing = FEniCS::dualPairing(x, z, 1); });
+    for(auto numberOfThreads = 2u; numberOfThreads <= 32; numberOfThreads *= 2)
+    {
+        auto y = x;
+        const auto optimized = seconds([&] { FEniCS::axpy(y, 0.5, z, numberOfThreads); });
+        EXPECT_EQ( y, expected );
+        report("axpy on " + std::to_string(numberOfThreads) + " threads vs. 1", reference, optimized);
+
+        auto parallelPairing = 0.;
+        const auto optimizedPairing = seconds([&] { parallelPairing = FEniCS::dualPairing(x, z, numberOfThreads); });
+        EXPECT_EQ( parallelPairing, pairing );
+        report("dual pairing on " + std::to_string(numberOfThreads) + " threads vs. 1", referencePairing, optimizedPairing);
+    }
+}
+
+TEST(FEniCSBenchmark,BatchedAssembly)
+{
+    LinearHeat::Form_F F(dolfin_V, test_function(dolfin_V, 1.), test_function(dolfin_V, 2.));
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScVector expectedB, b;
+    dolfin::PETScMatrix expectedA, A;
+    dolfin::Assembler dolfinAssembler;
+    FEniCS::LinearHeatKernels::Assembler assembler;
+
+    const auto referenceF = seconds([&] { dolfinAssembler.assemble(expectedB, F); });
+    const auto optimizedF = seconds([&] { assembler.assemble(b, F); });
+    EXPECT_LE( maxDifference(b, expectedB), 1e-12*expectedB.norm("linf") );
+    report("batched assembly of Form_F", referenceF, optimizedF);
+
+    const auto referenceJ = seconds([&] { dolfinAssembler.assemble(expectedA, J); });
+    const auto optimizedJ = seconds([&] { assembler.assemble(A, J); });
+    EXPECT_LE( maxDifference(A, expectedA), 1e-12*expectedA.norm("linf") );
+    report("batched assembly of Form_J", referenceJ, optimizedJ);
+}
+
+TEST(FEniCSBenchmark,MatrixFreeJacobian)
+{
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScMatrix A;
+    dolfin::assemble(A, J);
+    const auto v = test_function(dolfin_V, 1.);
+    auto expected = test_function(dolfin_V, 0.), y = test_function(dolfin_V, 0.);
+    const FEniCS::LinearHeatKernels::JacobianOperator op(J, V, V, true);
+
+    const auto reference = seconds([&] { A.mult(*v->vector(), *expected->vector()); });
+    const auto optimized = seconds([&] { op.apply(*v->vector(), *y->vector()); });
+    EXPECT_LE( maxDifference(*y->vector(), *expected->vector()), 1e-12*expected->vector()->norm("linf") );
+    report("matrix-free Form_J vs. assembled mult", reference, optimized);
+    std::cout << "[ TIMING   ] memory: assembled Form_J " << compressedRowStorage(A) << " bytes -> matrix-free "
+              << op.memoryUsage() << " bytes" << std::endl;
+}
+
+TEST(FEniCSBenchmark,GeometryCache)
+{
+    LinearHeat::Form_F F(dolfin_V, test_function(dolfin_V, 1.), test_function(dolfin_V, 2.));
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScVector expectedB, b;
+    dolfin::PETScMatrix expectedA, A;
+    FEniCS::LinearHeatKernels::Assembler assembler;
+    FEniCS::LinearHeatKernels::Assembler geometryAssembler(std::make_shared<FEniCS::AffineGeometry>(*mesh));
+
+    const auto referenceF = seconds([&] { assembler.assemble(expectedB, F); });
+    const auto optimizedF = seconds([&] { geometryAssembler.assemble(b, F); });
+    EXPECT_LE( maxDifference(b, expectedB), 1e-12*expectedB.norm("linf") );
+    report("Form_F with given geometry vs. per assembly", referenceF, optimizedF);
+
+    const auto referenceJ = seconds([&] { assembler.assemble(expectedA, J); });
+    const auto optimizedJ = seconds([&] { geometryAssembler.assemble(A, J); });
+    EXPECT_LE( maxDifference(A, expectedA), 1e-12*expectedA.norm("linf") );
+    report("Form_J with given geometry vs. per assembly", referenceJ, optimizedJ);
+}
+
+TEST(FEniCSBenchmark,CongruentCells)
+{
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScMatrix expectedA, A;
+    const auto geometry = std::make_shared<FEniCS::AffineGeometry>(*mesh);
+    FEniCS::LinearHeatKernels::Assembler assembler(geometry);
+    FEniCS::LinearHeatKernels::Assembler congruentAssembler(geometry, 256, true);
+
+    const auto reference = seconds([&] { assembler.assemble(expectedA, J); });
+    const auto optimized = seconds([&] { congruentAssembler.assemble(A, J); });
+    EXPECT_LE( maxDifference(A, expectedA), 1e-12*expectedA.norm("linf") );
+    report("Form_J with congruent cells vs. all cells", reference, optimized);
+}
+
+TEST(FEniCSBenchmark,QuadraticL2Functional)
+{
+    const auto x = test_function(dolfin_W, 1.);
+    L2Functional::Form_F F(mesh, x);
+    const FEniCS::QuadraticL2Functional f(*dolfin_W);
+    auto workspace = f.workspace();
+
+    auto expected = 0., value = 0.;
+    const auto reference = seconds([&] { expected = dolfin::assemble(F); });
+    const auto optimized = seconds([&] { value = f(*x->vector(), workspace); });
+    EXPECT_NEAR( value, expected, 1e-12*std::abs(expected) );
+    report("quadratic form vs. assembly of L2Functional", reference, optimized);
+
+    const auto allocations = numberOfAllocations.load();
+    f(*x->vector(), workspace);
+    EXPECT_EQ( numberOfAllocations - allocations, 0u );
+}
+
+TEST(FEniCSBenchmark,FusedAssembly)
+{
+    LinearHeat::Form_F F(dolfin_V, test_function(dolfin_V, 1.), test_function(dolfin_V, 2.));
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScVector expectedB, b;
+    dolfin::PETScMatrix expectedA, A;
+    FEniCS::LinearHeatKernels::Assembler assembler(std::make_shared<FEniCS::AffineGeometry>(*mesh));
+
+    const auto separate = seconds([&] { assembler.assemble(expectedB, F); assembler.assemble(expectedA, J); });
+    const auto fused = seconds([&] { assembler.assemble(b, A, F, J); });
+    EXPECT_LE( maxDifference(b, expectedB), 1e-12*expectedB.norm("linf") );
+    EXPECT_LE( maxDifference(A, expectedA), 1e-12*expectedA.norm("linf") );
+    report("fused vs. separate Form_F and Form_J", separate, fused);
+}
+
+TEST(FEniCSBenchmark,ColoredAssembly)
+{
+    LinearHeat::Form_F F(dolfin_V, test_function(dolfin_V, 1.), test_function(dolfin_V, 2.));
+    LinearHeat::Form_J J(dolfin_V, dolfin_V);
+    dolfin::PETScVector serialB, b;
+    dolfin::PETScMatrix serialA, A;
+    FEniCS::ColoredAssembler serialAssembler(1);
+
+    const auto referenceF = seconds([&] { serialAssembler.assemble(serialB, F); });
+    const auto referenceJ = seconds([&] { serialAssembler.assemble(serialA, J); });
+    for(auto numberOfThreads = 2u; numberOfThreads <= 64; numberOfThreads *= 2)
+    {
+        FEniCS::ColoredAssembler assembler(numberOfThreads);
+        const auto optimizedF = seconds([&] { assembler.assemble(b, F); });
+        EXPECT_EQ( maxDifference(b, serialB), 0. );
+        report("coloured Form_F on " + std::to_string(numberOfThreads) + " threads vs. 1", referenceF, optimizedF);
+
+        const auto optimizedJ = seconds([&] { assembler.assemble(A, J); });
+        EXPECT_EQ( maxDifference(A, serialA), 0. );
+        report("parallel Form_J on " + std::to_string(numberOfThreads) + " threads vs. 1", referenceJ, optimizedJ);
+    }
+}
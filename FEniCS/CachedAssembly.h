@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <petscvec.h>
+
+#include <ufc.h>
+
+#include <dolfin/fem/Form.h>
+#include <dolfin/fem/assemble.h>
+#include <dolfin/function/Constant.h>
+#include <dolfin/function/Function.h>
+#include <dolfin/function/GenericFunction.h>
+#include <dolfin/la/PETScVector.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      inline void collectEnabledCoefficients(const ufc::integral* integral, std::vector<bool>& used)
+      {
+        const std::unique_ptr<const ufc::integral> owner(integral);
+        if( !integral )
+          return;
+        const auto& enabled = integral->enabled_coefficients();
+        for(auto i=0u; i<enabled.size() && i<used.size(); ++i)
+          if( enabled[i] )
+            used[i] = true;
+      }
+
+      /// Identifies the value of a coefficient, such that changes can be detected without comparing function values.
+      struct CoefficientState
+      {
+        explicit CoefficientState(std::shared_ptr<const dolfin::GenericFunction> f)
+          : coefficient(std::move(f))
+        {
+          if( const auto constant = std::dynamic_pointer_cast<const dolfin::Constant>(coefficient) )
+          {
+            values = constant->values();
+            known = true;
+            return;
+          }
+          const auto function = std::dynamic_pointer_cast<const dolfin::Function>(coefficient);
+          if( !function )
+            return;
+          const auto vector = std::dynamic_pointer_cast<const dolfin::PETScVector>(function->vector());
+          if( !vector )
+            return;
+          PetscObjectStateGet(reinterpret_cast<PetscObject>(vector->vec()), &state);
+          known = true;
+        }
+
+        /// Expressions and non-PETSc vectors cannot be tracked and compare unequal to any state.
+        bool operator==(const CoefficientState& other) const
+        {
+          return known && other.known && coefficient == other.coefficient && state == other.state && values == other.values;
+        }
+
+        std::shared_ptr<const dolfin::GenericFunction> coefficient;
+        PetscObjectState state = 0;
+        std::vector<double> values;
+        bool known = false;
+      };
+    }
+
+    /**
+     * @brief Numbers of the coefficients (as in dolfin::Form::coefficient) that enter at least one integral of form.
+     *
+     * Collected from enabled_coefficients() of the generated integrals. Coefficients that ffc has removed during
+     * form simplification are not reported, e.g. the Jacobian of a linear problem does not depend on the iterate.
+     */
+    inline std::vector<std::size_t> coefficientDependencies(const ufc::form& form)
+    {
+      std::vector<bool> used(form.num_coefficients(), false);
+      Detail::collectEnabledCoefficients(form.create_default_cell_integral(), used);
+      Detail::collectEnabledCoefficients(form.create_default_exterior_facet_integral(), used);
+      Detail::collectEnabledCoefficients(form.create_default_interior_facet_integral(), used);
+      Detail::collectEnabledCoefficients(form.create_default_vertex_integral(), used);
+      for(auto i=0u; i<form.max_cell_subdomain_id(); ++i)
+        Detail::collectEnabledCoefficients(form.create_cell_integral(i), used);
+      for(auto i=0u; i<form.max_exterior_facet_subdomain_id(); ++i)
+        Detail::collectEnabledCoefficients(form.create_exterior_facet_integral(i), used);
+      for(auto i=0u; i<form.max_interior_facet_subdomain_id(); ++i)
+        Detail::collectEnabledCoefficients(form.create_interior_facet_integral(i), used);
+      for(auto i=0u; i<form.max_vertex_subdomain_id(); ++i)
+        Detail::collectEnabledCoefficients(form.create_vertex_integral(i), used);
+
+      std::vector<std::size_t> dependencies;
+      for(auto i=0u; i<used.size(); ++i)
+        if( used[i] )
+          dependencies.push_back(i);
+      return dependencies;
+    }
+
+    inline std::vector<std::size_t> coefficientDependencies(const dolfin::Form& form)
+    {
+      return coefficientDependencies(*form.ufc_form());
+    }
+
+    /**
+     * @brief Assembled form that is reassembled only if a coefficient it depends on has changed.
+     *
+     * A coefficient counts as changed if the form refers to a different object, if the PETSc state of the vector of a
+     * dolfin::Function has increased, or if the values of a dolfin::Constant differ. Other coefficients, e.g. Expressions,
+     * cannot be tracked and trigger reassembly whenever the form depends on them. Changes of the mesh are not detected
+     * and require invalidate().
+     *
+     * numberOfAssemblies() increases with each reassembly, such that solvers may keep a factorization of the tensor
+     * as long as it has not changed.
+     */
+    template <class Tensor>
+    class CachedAssembly
+    {
+    public:
+      explicit CachedAssembly(std::shared_ptr<const dolfin::Form> form)
+        : form_(std::move(form)),
+          dependencies_(coefficientDependencies(*form_))
+      {
+        if( form_->rank() != tensor_.rank() )
+          throw std::invalid_argument("CachedAssembly: rank of form and tensor do not match.");
+      }
+
+      /// The assembled form, reassembled if outdated.
+      const Tensor& get()
+      {
+        if( !isUpToDate() )
+        {
+          auto states = currentStates();
+          dolfin::assemble(tensor_, *form_);
+          states_ = std::move(states);
+          valid_ = true;
+          ++assemblies_;
+        }
+        return tensor_;
+      }
+
+      /// Checks if the assembled tensor still corresponds to the current coefficients.
+      bool isUpToDate() const
+      {
+        return valid_ && currentStates() == states_;
+      }
+
+      /// Enforces reassembly on the next call to get(), e.g. after the mesh has moved.
+      void invalidate()
+      {
+        valid_ = false;
+      }
+
+      std::size_t numberOfAssemblies() const
+      {
+        return assemblies_;
+      }
+
+      /// Coefficients the form depends on.
+      const std::vector<std::size_t>& dependencies() const
+      {
+        return dependencies_;
+      }
+
+    private:
+      std::vector<Detail::CoefficientState> currentStates() const
+      {
+        std::vector<Detail::CoefficientState> states;
+        for(auto i : dependencies_)
+          states.emplace_back(form_->coefficient(i));
+        return states;
+      }
+
+      std::shared_ptr<const dolfin::Form> form_;
+      std::vector<std::size_t> dependencies_;
+      Tensor tensor_;
+      std::vector<Detail::CoefficientState> states_;
+      bool valid_ = false;
+      std::size_t assemblies_ = 0;
+    };
+  }
+}
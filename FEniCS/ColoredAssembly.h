@@ -0,0 +1,349 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <mpi.h>
+
+#include <ufc.h>
+
+#include <dolfin/fem/AssemblerBase.h>
+#include <dolfin/fem/GenericDofMap.h>
+#include <dolfin/function/Function.h>
+#include <dolfin/function/FunctionSpace.h>
+#include <dolfin/la/GenericMatrix.h>
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/mesh/Mesh.h>
+
+#include "GeometryCache.h"
+#include "L2Functional.h"
+#include "LinearHeat.h"
+#include "LinearHeatKernels.h"
+#include "LocalArray.h"
+#include "Parallel.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Partition of the cells of a mesh into colours such that no two cells of one colour share a dof.
+     *
+     * Element tensors of the cells of one colour can be added to a global tensor concurrently without conflicts.
+     * Colours are assigned greedily in cell order, so the cells of each colour are sorted.
+     */
+    class CellColoring
+    {
+    public:
+      CellColoring(const dolfin::Mesh& mesh, const dolfin::GenericDofMap& dofmap)
+        : colors_(mesh.num_cells())
+      {
+        std::vector<std::vector<unsigned>> colorsOfDofs;
+        std::vector<bool> forbidden;
+        for(std::size_t cell=0; cell<mesh.num_cells(); ++cell)
+        {
+          const auto dofs = dofmap.cell_dofs(cell);
+          forbidden.assign(cells_.size() + 1, false);
+          for(auto i=0u; i<dofs.size(); ++i)
+          {
+            if( static_cast<std::size_t>(dofs[i]) >= colorsOfDofs.size() )
+              colorsOfDofs.resize(dofs[i] + 1);
+            for(auto color : colorsOfDofs[dofs[i]])
+              forbidden[color] = true;
+          }
+
+          const auto color = static_cast<unsigned>(std::find(forbidden.begin(), forbidden.end(), false) - forbidden.begin());
+          if( color == cells_.size() )
+            cells_.emplace_back();
+          cells_[color].push_back(cell);
+          colors_[cell] = color;
+          for(auto i=0u; i<dofs.size(); ++i)
+            colorsOfDofs[dofs[i]].push_back(color);
+        }
+      }
+
+      std::size_t numberOfColors() const
+      {
+        return cells_.size();
+      }
+
+      /// Cells of colour k, in ascending order.
+      const std::vector<std::size_t>& cells(std::size_t k) const
+      {
+        return cells_[k];
+      }
+
+      unsigned colorOf(std::size_t cell) const
+      {
+        return colors_[cell];
+      }
+
+      std::size_t memoryUsage() const
+      {
+        auto result = colors_.capacity()*sizeof(unsigned);
+        for(const auto& cells : cells_)
+          result += cells.capacity()*sizeof(std::size_t);
+        return result;
+      }
+
+    private:
+      std::vector<unsigned> colors_;
+      std::vector<std::vector<std::size_t>> cells_;
+    };
+
+    namespace Detail
+    {
+      /// Contributions to rows that the process does not own, added after the concurrent phase.
+      struct GhostRows
+      {
+        void add(dolfin::la_index row, double value)
+        {
+          rows.push_back(row);
+          values.push_back(value);
+        }
+
+        void add(dolfin::la_index row, const double* rowValues, const dolfin::la_index* rowColumns, std::size_t n)
+        {
+          rows.push_back(row);
+          sizes.push_back(n);
+          values.insert(values.end(), rowValues, rowValues + n);
+          columns.insert(columns.end(), rowColumns, rowColumns + n);
+        }
+
+        std::vector<dolfin::la_index> rows, columns;
+        std::vector<std::size_t> sizes;
+        std::vector<double> values;
+      };
+    }
+
+    /**
+     * @brief Thread-parallel assembly of the forms of LinearHeat.ufl and L2Functional.ufl.
+     *
+     * Vectors are assembled colour by colour (see CellColoring). The cells of one colour are split into
+     * blocks that threads tabulate with the batched kernels of LinearHeatKernels.
+     * Coefficient values of all cells are read once before the parallel phase.
+     * Each entry receives its contributions in colour order, so the result does not depend on the number of threads,
+     * but differs from dolfin::Assembler by rounding. Functionals need no colouring and sum the per-block results in
+     * block order.
+     *
+     * Threads add vector entries to the process-local array directly, without locks or atomics, as the cells of one colour
+     * share no dofs. Rows that the process does not own are collected and added afterwards on the calling thread.
+     * Matrices are not coloured: add_local of PETSc matrices must not be called from several threads, so threads only
+     * tabulate blocks of consecutive cells and the calling thread adds them in cell order. Only the tabulation scales
+     * with the number of threads, and the matrix equals the one of dolfin::Assembler.
+     * Tensors are initialized and finalized like with dolfin::Assembler.
+     *
+     * Colourings are computed on first use per function space and held by the assembler, so an assembler that is
+     * reused for repeated assemblies colours each mesh once.
+     */
+    class ColoredAssembler : public dolfin::AssemblerBase
+    {
+    public:
+      explicit ColoredAssembler(unsigned numberOfThreads = defaultNumberOfThreads(), std::size_t blockSize = 256)
+        : numberOfThreads_(std::max(numberOfThreads, 1u)),
+          blockSize_(std::max<std::size_t>(blockSize, 1))
+      {}
+
+      void assemble(dolfin::GenericVector& b, const LinearHeat::Form_F& F)
+      {
+        const auto& mesh = checkMesh(F);
+        init_global_tensor(b, F);
+
+        const auto& V = *F.function_space(0);
+        const auto& dofmap = *V.dofmap();
+        const auto& coloring = this->coloring(V);
+        const auto owned = numberOfOwnedDofs(dofmap);
+        const auto f = cellValues(*function(F, 0), mesh.num_cells(), 3);
+        const auto x = cellValues(*function(F, 1), mesh.num_cells(), 3);
+
+        std::vector<Detail::GhostRows> ghosts;
+        {
+          LocalArray array(b);
+          for(auto k=0u; k<coloring.numberOfColors(); ++k)
+          {
+            const auto& cells = coloring.cells(k);
+            std::vector<Detail::GhostRows> colorGhosts(numberOfBlocks(cells));
+            parallelFor(colorGhosts.size(), numberOfThreads_, [&](std::size_t block)
+            {
+              const auto* cellIndices = cells.data() + block*blockSize_;
+              const auto n = std::min(blockSize_, cells.size() - block*blockSize_);
+              std::vector<double> coordinates, fBlock, xBlock, A(3*n);
+              FEniCS::Detail::fillCoordinates(mesh, 0, n, coordinates, cellIndices);
+              blockValues(f, cellIndices, n, 3, fBlock);
+              blockValues(x, cellIndices, n, 3, xBlock);
+              LinearHeatKernels::tabulateF(A.data(), fBlock.data(), xBlock.data(), coordinates.data(), n);
+
+              for(auto c=0u; c<n; ++c)
+              {
+                const auto dofs = dofmap.cell_dofs(cellIndices[c]);
+                for(auto i=0u; i<3; ++i)
+                  if( static_cast<std::size_t>(dofs[i]) < owned )
+                    array[dofs[i]] += A[i*n+c];
+                  else
+                    colorGhosts[block].add(dofs[i], A[i*n+c]);
+              }
+            });
+            std::move(colorGhosts.begin(), colorGhosts.end(), std::back_inserter(ghosts));
+          }
+        }
+
+        for(const auto& blockGhosts : ghosts)
+          for(auto i=0u; i<blockGhosts.rows.size(); ++i)
+            b.add_local(&blockGhosts.values[i], 1, &blockGhosts.rows[i]);
+        if( finalize_tensor )
+          b.apply("add");
+      }
+
+      void assemble(dolfin::GenericMatrix& M, const LinearHeat::Form_J& J)
+      {
+        const auto& mesh = checkMesh(J);
+        init_global_tensor(M, J);
+
+        const auto& rowDofmap = *J.function_space(0)->dofmap();
+        const auto& columnDofmap = *J.function_space(1)->dofmap();
+
+        // one block per thread and round, added in cell order after the round
+        std::vector<std::vector<double>> tensors(numberOfThreads_);
+        for(std::size_t first=0; first<mesh.num_cells(); first+=tensors.size()*blockSize_)
+        {
+          const auto blocks = std::min(tensors.size(), (mesh.num_cells() - first + blockSize_ - 1)/blockSize_);
+          parallelFor(blocks, numberOfThreads_, [&](std::size_t block)
+          {
+            const auto blockFirst = first + block*blockSize_;
+            const auto n = std::min(blockSize_, mesh.num_cells() - blockFirst);
+            std::vector<double> coordinates;
+            FEniCS::Detail::fillCoordinates(mesh, blockFirst, n, coordinates);
+            tensors[block].resize(9*n);
+            LinearHeatKernels::tabulateJ(tensors[block].data(), coordinates.data(), n);
+          });
+
+          double cellValues[9];
+          for(auto block=0u; block<blocks; ++block)
+          {
+            const auto& A = tensors[block];
+            const auto n = A.size()/9;
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto cell = first + block*blockSize_ + c;
+              const auto rows = rowDofmap.cell_dofs(cell);
+              const auto columns = columnDofmap.cell_dofs(cell);
+              for(auto i=0u; i<9; ++i)
+                cellValues[i] = A[i*n+c];
+              M.add_local(cellValues, rows.size(), rows.data(), columns.size(), columns.data());
+            }
+          }
+        }
+        if( finalize_tensor )
+          M.apply("add");
+      }
+
+      /// Value of Form_F of L2Functional.ufl, summed over all processes.
+      double assemble(const L2Functional::Form_F& F)
+      {
+        const auto& mesh = checkMesh(F);
+        const auto x = cellValues(*function(F, 0), mesh.num_cells(), 9);
+        const std::unique_ptr<const ufc::cell_integral> integral(F.ufc_form()->create_default_cell_integral());
+
+        std::vector<double> partial((mesh.num_cells() + blockSize_ - 1)/blockSize_, 0.);
+        parallelFor(partial.size(), numberOfThreads_, [&](std::size_t block)
+        {
+          const auto first = block*blockSize_;
+          const auto n = std::min(blockSize_, mesh.num_cells() - first);
+          std::vector<double> coordinates;
+          FEniCS::Detail::fillCoordinates(mesh, first, n, coordinates);
+          auto result = 0.;
+          for(auto c=0u; c<n; ++c)
+          {
+            double cellCoordinates[6], value = 0.;
+            for(auto k=0u; k<6; ++k)
+              cellCoordinates[k] = coordinates[k*n + c];
+            const double* w[1] = { &x[9*(first + c)] };
+            integral->tabulate_tensor(&value, w, cellCoordinates, 0);
+            result += value;
+          }
+          partial[block] = result;
+        });
+
+        auto result = 0.;
+        for(auto value : partial)
+          result += value;
+        MPI_Allreduce(MPI_IN_PLACE, &result, 1, MPI_DOUBLE, MPI_SUM, mesh.mpi_comm());
+        return result;
+      }
+
+      /// Colouring of the cells of the mesh of V with respect to the dofs of V, computed on first use.
+      const CellColoring& coloring(const dolfin::FunctionSpace& V)
+      {
+        auto& coloring = colorings_[V.id()];
+        if( !coloring )
+          coloring = std::make_unique<CellColoring>(*V.mesh(), *V.dofmap());
+        return *coloring;
+      }
+
+    private:
+      std::size_t numberOfBlocks(const std::vector<std::size_t>& cells) const
+      {
+        return (cells.size() + blockSize_ - 1)/blockSize_;
+      }
+
+      static const dolfin::Mesh& checkMesh(const dolfin::Form& form)
+      {
+        const auto& mesh = *form.mesh();
+        if( mesh.topology().dim() != 2 || mesh.geometry().dim() != 2 )
+          throw std::invalid_argument("ColoredAssembler: requires a triangle mesh in 2D.");
+        return mesh;
+      }
+
+      static std::shared_ptr<const dolfin::Function> function(const dolfin::Form& form, std::size_t i)
+      {
+        const auto f = std::dynamic_pointer_cast<const dolfin::Function>(form.coefficient(i));
+        if( !f )
+          throw std::invalid_argument("ColoredAssembler: coefficients must be dolfin::Functions.");
+        return f;
+      }
+
+      /// Local dofs 0, ..., numberOfOwnedDofs(dofmap)-1 are owned by the process, the remaining ones are ghosts.
+      static std::size_t numberOfOwnedDofs(const dolfin::GenericDofMap& dofmap)
+      {
+        const auto range = dofmap.ownership_range();
+        return range.second - range.first;
+      }
+
+      /// Values of f on all cells, values[dofsPerCell*cell + k], read with one get_local.
+      static std::vector<double> cellValues(const dolfin::Function& f, std::size_t numberOfCells, std::size_t dofsPerCell)
+      {
+        const auto& dofmap = *f.function_space()->dofmap();
+        std::vector<dolfin::la_index> rows(dofsPerCell*numberOfCells);
+        for(std::size_t cell=0; cell<numberOfCells; ++cell)
+        {
+          const auto dofs = dofmap.cell_dofs(cell);
+          if( static_cast<std::size_t>(dofs.size()) != dofsPerCell )
+            throw std::invalid_argument("ColoredAssembler: unexpected number of dofs per cell of coefficient.");
+          std::copy(dofs.data(), dofs.data() + dofsPerCell, &rows[dofsPerCell*cell]);
+        }
+        std::vector<double> values(rows.size());
+        f.vector()->get_local(values.data(), rows.size(), rows.data());
+        return values;
+      }
+
+      /// Values of the given n cells in structure-of-arrays layout, as expected by the batched kernels.
+      static void blockValues(const std::vector<double>& values, const std::size_t* cellIndices, std::size_t n,
+                              std::size_t dofsPerCell, std::vector<double>& result)
+      {
+        result.resize(dofsPerCell*n);
+        for(auto c=0u; c<n; ++c)
+          for(auto k=0u; k<dofsPerCell; ++k)
+            result[k*n + c] = values[dofsPerCell*cellIndices[c] + k];
+      }
+
+      unsigned numberOfThreads_;
+      std::size_t blockSize_;
+      std::map<std::size_t, std::unique_ptr<CellColoring>> colorings_;
+    };
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <mpi.h>
+
+#include <dolfin/la/GenericVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+#include "LocalArray.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// Maximal number of leaves of a product space vector that equal() compares.
+      constexpr unsigned maxComparedLeaves = 16;
+
+      /// Adds the process-local squared norms of x-y, x and y to sums[0], sums[1] and sums[2], in one pass.
+      inline void addComparisonSums(const Vector& x, const Vector& y, double* sums)
+      {
+        ConstLocalArray x_(x.get());
+        ConstLocalArray y_(y.get());
+        const auto size = x_.size();
+        if( y_.size() != size )
+          throw std::invalid_argument("equal: local sizes of vectors do not match.");
+        const auto* xData = x_.data();
+        const auto* yData = y_.data();
+        for(auto i=0u; i<size; ++i)
+        {
+          const auto dx = xData[i] - yData[i];
+          sums[0] += dx*dx;
+          sums[1] += xData[i]*xData[i];
+          sums[2] += yData[i]*yData[i];
+        }
+      }
+
+      /// |x-y| < eps*max(|x|,|y|) for the global squared norms in sums.
+      inline bool isEqual(const double* sums, double eps)
+      {
+        auto max = std::sqrt(std::max(sums[1], sums[2]));
+        if( max == 0 )
+          max = 1;
+        return std::sqrt(sums[0]) < max*eps;
+      }
+
+      /// Adds the sums of each leaf k of x and y to sums[3k], ..., sums[3k+2] and stores its eps and communicator, starting with leaf n.
+      /// Returns the number of leaves.
+      inline unsigned addComparisonSums(const ::Spacy::Vector& x, const ::Spacy::Vector& y, double* sums, double* eps, MPI_Comm& comm, unsigned n)
+      {
+        if( is<ProductSpace::Vector>(x) )
+        {
+          const auto& x_ = cast_ref<ProductSpace::Vector>(x);
+          const auto& y_ = cast_ref<ProductSpace::Vector>(y);
+          for(auto k=0u; k<x_.numberOfVariables(); ++k)
+            n = addComparisonSums(x_.component(k), y_.component(k), sums, eps, comm, n);
+          return n;
+        }
+
+        if( n == maxComparedLeaves )
+          throw std::length_error("equal: product space vector has too many components.");
+        const auto& x_ = cast_ref<Vector>(x);
+        addComparisonSums(x_, cast_ref<Vector>(y), sums + 3*n);
+        eps[n] = x_.space().eps();
+        comm = x_.get().mpi_comm();
+        return n + 1;
+      }
+    }
+
+    /**
+     * @brief Same result as x == y, i.e. |x-y| < eps*max(|x|,|y|) in the l2-norm with eps of the space of x, but without temporaries.
+     *
+     * The three squared norms are accumulated in one pass over the process-local arrays and combined with a single MPI_Allreduce.
+     */
+    inline bool equal(const Vector& x, const Vector& y)
+    {
+      double sums[3] = {0., 0., 0.};
+      Detail::addComparisonSums(x, y, sums);
+      MPI_Allreduce(MPI_IN_PLACE, sums, 3, MPI_DOUBLE, MPI_SUM, x.get().mpi_comm());
+      return Detail::isEqual(sums, x.space().eps());
+    }
+
+    /**
+     * @brief Allocation-free comparison of FEniCS vectors and product space vectors thereof, component-wise for the latter.
+     *
+     * The sums of all components are kept on the stack and combined with a single MPI_Allreduce, hence at most
+     * Detail::maxComparedLeaves FEniCS vectors are supported.
+     */
+    inline bool equal(const ::Spacy::Vector& x, const ::Spacy::Vector& y)
+    {
+      if( !is<ProductSpace::Vector>(x) )
+        return equal(cast_ref<Vector>(x), cast_ref<Vector>(y));
+
+      double sums[3*Detail::maxComparedLeaves] = {};
+      double eps[Detail::maxComparedLeaves];
+      MPI_Comm comm = MPI_COMM_WORLD;
+      const auto n = Detail::addComparisonSums(x, y, sums, eps, comm, 0);
+      MPI_Allreduce(MPI_IN_PLACE, sums, 3*n, MPI_DOUBLE, MPI_SUM, comm);
+      for(auto k=0u; k<n; ++k)
+        if( !Detail::isEqual(sums + 3*k, eps[k]) )
+          return false;
+      return true;
+    }
+  }
+}
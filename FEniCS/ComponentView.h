@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/function/Function.h>
+#include <dolfin/function/FunctionSpace.h>
+#include <dolfin/la/GenericVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "Dofmap.h"
+#include "LocalArray.h"
+#include "SubSpaces.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /// Strided, non-owning view onto the entries of one sub-space of an interleaved mixed vector.
+    class ComponentView
+    {
+    public:
+      ComponentView(double* data, std::size_t offset, std::size_t stride, std::size_t size)
+        : data_(data + offset), stride_(stride), size_(size)
+      {}
+
+      double& operator[](std::size_t i)
+      {
+        return data_[i*stride_];
+      }
+
+      double operator[](std::size_t i) const
+      {
+        return data_[i*stride_];
+      }
+
+      std::size_t size() const
+      {
+        return size_;
+      }
+
+    private:
+      double* data_;
+      std::size_t stride_;
+      std::size_t size_;
+    };
+
+    /**
+     * @brief Offsets and strides of the sub-spaces of V in the mixed dolfin vectors of a function space.
+     *
+     * Detecting the strides inspects every entry of the sub-space dofmaps. Build the layout once per pair of spaces and
+     * construct the views from it. Requires that every sub-space dofmap is of the form dofmap(i) = offset + i*stride,
+     * as is the case for interleaved mixed spaces such as L2Functional::CoefficientSpace_x.
+     */
+    class MixedVectorLayout
+    {
+    public:
+      struct Component
+      {
+        /// Number of the sub-space in the mixed dolfin::FunctionSpace.
+        unsigned id;
+        std::size_t offset;
+        std::size_t stride;
+        std::size_t size;
+      };
+
+      MixedVectorLayout(const VectorSpace& V, const dolfin::FunctionSpace& dolfinSpace)
+        : dimension_(dolfinSpace.dim())
+      {
+        const auto firstLocalDof = dolfinSpace.dofmap()->ownership_range().first;
+        for(const auto& subSpace : subSpaces(V))
+        {
+          const Dofmap dofmap(creator<VectorCreator>(*subSpace.space), firstLocalDof);
+          if( !dofmap.isAffine() )
+            throw std::invalid_argument("MixedVectorLayout: dofmap of sub-space is not strided.");
+          components_.push_back({subSpace.id, dofmap.offset(), dofmap.stride(), dofmap.size()});
+        }
+      }
+
+      const std::vector<Component>& components() const
+      {
+        return components_;
+      }
+
+      /// Global dimension of the mixed dolfin vectors.
+      std::size_t dimension() const
+      {
+        return dimension_;
+      }
+
+    private:
+      std::size_t dimension_;
+      std::vector<Component> components_;
+    };
+
+    /**
+     * @brief Component-wise access to a mixed dolfin vector without copying.
+     *
+     * Holds the process-local array of a PETSc backed dolfin::GenericVector for its lifetime and provides
+     * one ComponentView per sub-space of the layout. Writes become visible in the dolfin vector once the view is destroyed.
+     * Construction only acquires the array and sets up one view per component of the layout.
+     */
+    class MixedVectorView
+    {
+    public:
+      MixedVectorView(dolfin::GenericVector& v, const MixedVectorLayout& layout)
+        : array_(v)
+      {
+        if( v.size() != layout.dimension() )
+          throw std::invalid_argument("MixedVectorView: dolfin vector does not belong to the function space of the layout.");
+        for(const auto& component : layout.components())
+        {
+          ids_.push_back(component.id);
+          components_.emplace_back(array_.data(), component.offset, component.stride, component.size);
+        }
+      }
+
+      MixedVectorView(dolfin::Function& f, const MixedVectorLayout& layout)
+        : MixedVectorView(*f.vector(), layout)
+      {}
+
+      /// View onto the sub-space with number id in the mixed dolfin::FunctionSpace.
+      ComponentView& component(unsigned id)
+      {
+        return components_[index(id)];
+      }
+
+      const ComponentView& component(unsigned id) const
+      {
+        return components_[index(id)];
+      }
+
+      std::size_t numberOfComponents() const
+      {
+        return components_.size();
+      }
+
+    private:
+      std::size_t index(unsigned id) const
+      {
+        const auto iter = std::find(begin(ids_), end(ids_), id);
+        if( iter == end(ids_) )
+          throw std::out_of_range("MixedVectorView: no sub-space with this id.");
+        return iter - begin(ids_);
+      }
+
+      LocalArray array_;
+      std::vector<unsigned> ids_;
+      std::vector<ComponentView> components_;
+    };
+  }
+}
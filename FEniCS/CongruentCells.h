@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/mesh/Mesh.h>
+
+#include "GeometryCache.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Partition of the cells of a triangle mesh into classes of translated copies of each other.
+     *
+     * Two cells belong to the same class if the Jacobians of their reference maps agree up to tolerance times the
+     * largest Jacobian entry of the mesh. Element tensors that depend on the cell only through its Jacobian, such as
+     * the stiffness matrix of Form_J in LinearHeat.ufl, therefore need to be computed only once per class.
+     * On the structured meshes of dolfin, e.g. UnitSquareMesh, all cells fall into two classes.
+     */
+    class CongruentCells
+    {
+    public:
+      explicit CongruentCells(const dolfin::Mesh& mesh, double tolerance = 1e-10, std::size_t blockSize = 256)
+        : classes_(mesh.num_cells())
+      {
+        if( mesh.topology().dim() != 2 || mesh.geometry().dim() != 2 )
+          throw std::invalid_argument("CongruentCells: requires a triangle mesh in 2D.");
+
+        std::vector<std::array<double, 4>> jacobians(mesh.num_cells());
+        std::vector<double> coordinates;
+        auto scale = 0.;
+        for(std::size_t first=0; first<mesh.num_cells(); first+=blockSize)
+        {
+          const auto n = std::min(blockSize, mesh.num_cells() - first);
+          Detail::fillCoordinates(mesh, first, n, coordinates);
+          for(auto c=0u; c<n; ++c)
+          {
+            auto& J = jacobians[first + c];
+            J = { coordinates[2*n+c] - coordinates[0*n+c], coordinates[4*n+c] - coordinates[0*n+c],
+                  coordinates[3*n+c] - coordinates[1*n+c], coordinates[5*n+c] - coordinates[1*n+c] };
+            for(auto entry : J)
+              scale = std::max(scale, std::abs(entry));
+          }
+        }
+
+        const auto resolution = tolerance*(scale > 0 ? scale : 1.);
+        std::map<std::array<long long, 4>, unsigned> keys;
+        for(auto cell=0u; cell<jacobians.size(); ++cell)
+        {
+          std::array<long long, 4> key;
+          for(auto k=0u; k<4; ++k)
+            key[k] = std::llround(jacobians[cell][k]/resolution);
+          const auto inserted = keys.emplace(key, representatives_.size());
+          if( inserted.second )
+            representatives_.push_back(cell);
+          classes_[cell] = inserted.first->second;
+        }
+      }
+
+      std::size_t numberOfClasses() const
+      {
+        return representatives_.size();
+      }
+
+      /// Class of cell, in 0, ..., numberOfClasses()-1.
+      unsigned classOf(std::size_t cell) const
+      {
+        return classes_[cell];
+      }
+
+      /// First cell of class k, whose element tensors stand for the whole class.
+      std::size_t representative(std::size_t k) const
+      {
+        return representatives_[k];
+      }
+
+      std::size_t memoryUsage() const
+      {
+        return classes_.capacity()*sizeof(unsigned) + representatives_.capacity()*sizeof(std::size_t);
+      }
+
+    private:
+      std::vector<unsigned> classes_;
+      std::vector<std::size_t> representatives_;
+    };
+  }
+}
@@ -7,10 +7,16 @@
 #include <Spacy/Adapter/FEniCS/Vector.h>
 #include <Spacy/Adapter/FEniCS/VectorSpace.h>
 
+#include "ComponentView.h"
+#include "CopyPlan.h"
+#include "FlatVector.h"
+#include "LocalArray.h"
 #include "LinearHeat.h"
 #include "L2Functional.h"
 
 #include <iostream>
+#include <thread>
+#include <vector>
 
 using namespace Spacy;
 
@@ -384,3 +390,389 @@ TEST(FEniCSUtilCopy,DolfinFunctionToSpacyVector_PrimalDualProductSpace_ThreeVari
     for(auto i=0; i<degrees_of_freedom; ++i)
         EXPECT_EQ( vp[i], p_offset + i );
 }
+
+
+// Bulk access to the local arrays
+TEST(FEniCSUtilCopy,SetLocalCoincidesWithSetitem_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = zero(V2DPrimalDual);
+    auto& v_ = cast_ref<ProductSpace::Vector>(v);
+    auto& v_primal = cast_ref<ProductSpace::Vector>(v_.component(PRIMAL));
+    auto& v_dual = cast_ref<ProductSpace::Vector>(v_.component(DUAL));
+
+    std::vector<double> y(degrees_of_freedom), u(degrees_of_freedom), p(degrees_of_freedom);
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        y[i] = 10+i;
+        u[i] = 100+i;
+        p[i] = 1000+i;
+    }
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(v_primal.component(0)), y);
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(v_primal.component(1)), u);
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(v_dual.component(0)), p);
+
+    EXPECT_EQ( v, primal_dual_test_vector_2D() );
+}
+
+TEST(FEniCSUtilCopy,SetAndGetLocalOfMixedFunction)
+{
+    auto f = dolfin::Function(dolfin_V2D);
+    const auto g = test_function_2D();
+
+    std::vector<double> values(number_of_variables*degrees_of_freedom);
+    FEniCS::getLocal(*g.vector(), values.data(), values.size());
+    for(auto j=0; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( values[i*number_of_variables +j], pow(10,j+1) + i );
+
+    FEniCS::setLocal(*f.vector(), values);
+    for(auto k=0; k<number_of_variables*degrees_of_freedom; ++k)
+        EXPECT_EQ( (*f.vector())[k], (*g.vector())[k] );
+}
+
+
+// Strided component views into mixed dolfin vector
+TEST(FEniCSUtilCopy,WriteThroughComponentView_ProductSpace_ThreeVariables)
+{
+    auto f = dolfin::Function(dolfin_V2D);
+    const FEniCS::MixedVectorLayout layout(V2D, *dolfin_V2D);
+
+    {
+        FEniCS::MixedVectorView view(f, layout);
+        ASSERT_EQ( view.numberOfComponents(), number_of_variables );
+        for(auto j=0; j<number_of_variables; ++j)
+        {
+            ASSERT_EQ( view.component(j).size(), degrees_of_freedom );
+            for(auto i=0; i<degrees_of_freedom; ++i)
+                view.component(j)[i] = pow(10,j+1) + i;
+        }
+    }
+
+    for(auto j=0; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( (*f.vector())[i*number_of_variables +j], pow(10,j+1) + i );
+}
+
+TEST(FEniCSUtilCopy,ReadThroughComponentView_PermutedProductSpace_ThreeVariables)
+{
+    auto f = test_function_2D();
+
+    const FEniCS::MixedVectorLayout layout(V2D_perm, *dolfin_V2D);
+    FEniCS::MixedVectorView view(f, layout);
+
+    constexpr auto
+            y_offset = 10,
+            u_offset = 100,
+            p_offset = 1000;
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( view.component(0)[i], y_offset + i );
+        EXPECT_EQ( view.component(1)[i], u_offset + i );
+        EXPECT_EQ( view.component(2)[i], p_offset + i );
+    }
+}
+
+TEST(FEniCSUtilCopy,WriteThroughComponentView_PrimalDualProductSpace_ThreeVariables)
+{
+    auto f = test_function_2D();
+
+    const FEniCS::MixedVectorLayout layout(V2DPrimalDual, *dolfin_V2D);
+    {
+        FEniCS::MixedVectorView view(f, layout);
+        ASSERT_EQ( view.numberOfComponents(), number_of_variables );
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            view.component(2)[i] *= -1;
+    }
+
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( (*f.vector())[i*number_of_variables], 10 + i );
+        EXPECT_EQ( (*f.vector())[i*number_of_variables+1], 100 + i );
+        EXPECT_EQ( (*f.vector())[i*number_of_variables+2], -1000 - i );
+    }
+}
+
+TEST(FEniCSUtilCopy,ComponentViewCoincidesWithCopy_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = zero(V2DPrimalDual);
+    auto f = test_function_2D();
+
+    FEniCS::copy(f, v);
+    const FEniCS::MixedVectorLayout layout(V2DPrimalDual, *dolfin_V2D);
+    FEniCS::MixedVectorView view(f, layout);
+
+    const auto& v_ = cast_ref<ProductSpace::Vector>(v);
+    const auto& vp_ = cast_ref<ProductSpace::Vector>(v_.component(PRIMAL));
+    const auto& vd_ = cast_ref<ProductSpace::Vector>(v_.component(DUAL));
+    const auto& vy = cast_ref<FEniCS::Vector>(vp_.component(0)).get();
+    const auto& vu = cast_ref<FEniCS::Vector>(vp_.component(1)).get();
+    const auto& vp = cast_ref<FEniCS::Vector>(vd_.component(0)).get();
+
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( view.component(0)[i], vy[i] );
+        EXPECT_EQ( view.component(1)[i], vu[i] );
+        EXPECT_EQ( view.component(2)[i], vp[i] );
+    }
+}
+
+TEST(FEniCSUtilCopy,ComponentViewsShareLayout)
+{
+    const FEniCS::MixedVectorLayout layout(V2D, *dolfin_V2D);
+    auto f = test_function_2D(), g = dolfin::Function(dolfin_V2D);
+
+    {
+        const FEniCS::MixedVectorView from(f, layout);
+        FEniCS::MixedVectorView to(g, layout);
+        for(auto j=0; j<number_of_variables; ++j)
+            for(auto i=0; i<degrees_of_freedom; ++i)
+                to.component(j)[i] = from.component(j)[i];
+    }
+
+    for(auto k=0; k<number_of_variables*degrees_of_freedom; ++k)
+        EXPECT_EQ( (*g.vector())[k], (*f.vector())[k] );
+
+    auto h = dolfin::Function(dolfin_V1D);
+    EXPECT_THROW( FEniCS::MixedVectorView(h, layout), std::invalid_argument );
+}
+
+
+// Copy with cached copy plan
+TEST(FEniCSUtilCopy,CopyPlanIsReusable)
+{
+    const FEniCS::CopyPlan plan(V2D, *dolfin_V2D);
+    auto f = dolfin::Function(dolfin_V2D);
+    auto v = zero(V2D);
+
+    for(auto k=0; k<2; ++k)
+    {
+        plan.copy(test_vector_2D(), f);
+        plan.copy(f, v);
+        EXPECT_EQ( v, test_vector_2D() );
+    }
+}
+
+TEST(FEniCSUtilCopy,CopyPlanIsLazy)
+{
+    const FEniCS::CopyPlan plan(V2D, *dolfin_V2D);
+    EXPECT_FALSE( plan.isInitialized() );
+
+    plan.warmup();
+    EXPECT_TRUE( plan.isInitialized() );
+}
+
+TEST(FEniCSUtilCopy,CopyPlanInitializesConcurrently)
+{
+    const FEniCS::CopyPlan plan(V2D, *dolfin_V2D);
+    std::vector<::Spacy::Vector> vectors(4, test_vector_2D());
+    std::vector<dolfin::Function> functions(vectors.size(), dolfin::Function(dolfin_V2D));
+
+    std::vector<std::thread> threads;
+    for(auto k=0u; k<vectors.size(); ++k)
+        threads.emplace_back([&plan,&vectors,&functions,k] { plan.copy(vectors[k], functions[k]); });
+    for(auto& thread : threads)
+        thread.join();
+
+    EXPECT_TRUE( plan.isInitialized() );
+    for(const auto& f : functions)
+        for(auto j=0; j<number_of_variables; ++j)
+            for(auto i=0; i<degrees_of_freedom; ++i)
+                EXPECT_EQ( (*f.vector())[i*number_of_variables +j], pow(10,j+1) + i );
+}
+
+TEST(FEniCSUtilCopy,ParallelCopyWithPlan_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = primal_dual_test_vector_2D();
+    auto f = dolfin::Function(dolfin_V2D);
+    const FEniCS::CopyPlan plan(V2DPrimalDual, *dolfin_V2D);
+
+    plan.copy(v, f, number_of_variables);
+
+    for(auto j=0; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( (*f.vector())[i*number_of_variables +j], pow(10,j+1) + i );
+
+    auto w = zero(V2DPrimalDual);
+    plan.copy(f, w, number_of_variables);
+    EXPECT_EQ( w, v );
+}
+
+TEST(FEniCSUtilCopy,CopyPlanRejectsVectorOfOtherSpace)
+{
+    const FEniCS::CopyPlan plan(V2D, *dolfin_V2D);
+    auto v = test_vector_2D();
+    auto f = dolfin::Function(dolfin_V1D);
+
+    EXPECT_THROW( plan.copy(v, f), std::invalid_argument );
+    EXPECT_THROW( plan.copy(f, v), std::invalid_argument );
+
+    const auto finerMesh = std::make_shared<dolfin::UnitIntervalMesh>(MPI_COMM_WORLD, 2*degrees_of_freedom);
+    const auto W = Spacy::FEniCS::makeHilbertSpace(std::make_shared<LinearHeat::FunctionSpace>(finerMesh));
+    auto w = zero(W);
+    auto g = test_function_1D();
+    const FEniCS::CopyPlan plan1D(V1D, *dolfin_V1D);
+    EXPECT_THROW( plan1D.copy(w, g), std::invalid_argument );
+    EXPECT_THROW( plan1D.copy(g, w), std::invalid_argument );
+}
+
+TEST(FEniCSUtilCopy,CopyPlanMemoryUsage)
+{
+    const FEniCS::CopyPlan plan(V2D, *dolfin_V2D);
+    plan.warmup();
+
+    EXPECT_GE( plan.memoryUsage(), number_of_variables*sizeof(FEniCS::Dofmap) );
+    EXPECT_LT( plan.memoryUsage(), number_of_variables*degrees_of_freedom*sizeof(std::size_t) + 1024 );
+}
+
+TEST(FEniCSUtilCopy,SpacyVectorToDolfinFunctionWithPlan_OneVariable)
+{
+    auto v = test_vector_1D();
+    auto f = dolfin::Function(dolfin_V1D);
+
+    FEniCS::CopyPlan(V1D, *dolfin_V1D).copy(v, f);
+
+    EXPECT_EQ( (*f.vector())[0], 1 );
+    EXPECT_EQ( (*f.vector())[1], 2 );
+}
+
+TEST(FEniCSUtilCopy,DolfinFunctionToSpacyVectorWithPlan_OneVariable)
+{
+    auto v = zero(V1D);
+    auto f = test_function_1D();
+
+    FEniCS::CopyPlan(V1D, *dolfin_V1D).copy(f, v);
+
+    const auto& v_ = cast_ref<FEniCS::Vector>(v).get();
+    EXPECT_EQ( v_[0], 2 );
+    EXPECT_EQ( v_[1], 3 );
+}
+
+TEST(FEniCSUtilCopy,SpacyVectorToDolfinFunctionWithPlan_ProductSpace_ThreeVariables)
+{
+    auto v = test_vector_2D();
+    auto f = dolfin::Function(dolfin_V2D);
+
+    FEniCS::CopyPlan(V2D, *dolfin_V2D).copy(v, f);
+
+    for(auto j=0; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( (*f.vector())[i*number_of_variables +j], pow(10,j+1) + i );
+}
+
+TEST(FEniCSUtilCopy,DolfinFunctionToSpacyVectorWithPlan_PermutedProductSpace_ThreeVariables)
+{
+    auto v = zero(V2D_perm);
+    auto f = test_function_2D();
+
+    FEniCS::CopyPlan(V2D_perm, *dolfin_V2D).copy(f, v);
+
+    const auto& vp_ = cast_ref<ProductSpace::Vector>(v);
+    const auto& vy = cast_ref<FEniCS::Vector>(vp_.component(1)).get();
+    const auto& vu = cast_ref<FEniCS::Vector>(vp_.component(2)).get();
+    const auto& vp = cast_ref<FEniCS::Vector>(vp_.component(0)).get();
+
+    constexpr auto
+            y_offset = 10,
+            u_offset = 100,
+            p_offset = 1000;
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( vy[i], y_offset + i );
+        EXPECT_EQ( vu[i], u_offset + i );
+        EXPECT_EQ( vp[i], p_offset + i );
+    }
+}
+
+TEST(FEniCSUtilCopy,SpacyVectorToDolfinFunctionWithPlan_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = primal_dual_test_vector_2D();
+    auto f = dolfin::Function(dolfin_V2D);
+
+    FEniCS::CopyPlan(V2DPrimalDual, *dolfin_V2D).copy(v, f);
+
+    for(auto j=0; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( (*f.vector())[i*number_of_variables +j], pow(10,j+1) + i );
+}
+
+TEST(FEniCSUtilCopy,DolfinFunctionToSpacyVectorWithPlan_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = zero(V2DPrimalDual);
+    auto f = test_function_2D();
+
+    FEniCS::CopyPlan(V2DPrimalDual, *dolfin_V2D).copy(f, v);
+
+    const auto& v_ = cast_ref<ProductSpace::Vector>(v);
+    const auto& vp_ = cast_ref<ProductSpace::Vector>(v_.component(PRIMAL));
+    const auto& vd_ = cast_ref<ProductSpace::Vector>(v_.component(DUAL));
+    const auto& vy = cast_ref<FEniCS::Vector>(vp_.component(0)).get();
+    const auto& vu = cast_ref<FEniCS::Vector>(vp_.component(1)).get();
+    const auto& vp = cast_ref<FEniCS::Vector>(vd_.component(0)).get();
+
+    constexpr auto
+            y_offset = 10,
+            u_offset = 100,
+            p_offset = 1000;
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( vy[i], y_offset + i );
+        EXPECT_EQ( vu[i], u_offset + i );
+        EXPECT_EQ( vp[i], p_offset + i );
+    }
+}
+
+
+// Contiguous storage for product space vectors
+TEST(FEniCSUtilCopy,SpacyVectorToFlatVector_PrimalDualProductSpace_ThreeVariables)
+{
+    auto v = primal_dual_test_vector_2D();
+    FEniCS::FlatVector x(V2DPrimalDual);
+
+    x.copyFrom(v);
+
+    ASSERT_EQ( x.numberOfComponents(), number_of_variables );
+    ASSERT_EQ( x.size(), number_of_variables*degrees_of_freedom );
+    for(auto j=0u; j<number_of_variables; ++j)
+    {
+        EXPECT_EQ( x.offset(j), j*degrees_of_freedom );
+        const auto component = x.component(j);
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( component[i], pow(10,j+1) + i );
+    }
+}
+
+TEST(FEniCSUtilCopy,FlatVectorToSpacyVector_PermutedProductSpace_ThreeVariables)
+{
+    auto v = zero(V2D_perm);
+    FEniCS::FlatVector x(V2D_perm);
+    for(auto j=0u; j<number_of_variables; ++j)
+    {
+        auto component = x.component(j);
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            component[i] = pow(10,j+1) + i;
+    }
+
+    x.copyTo(v);
+
+    const auto& v_ = cast_ref<ProductSpace::Vector>(v);
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D_perm);
+    for(auto j=0u; j<number_of_variables; ++j)
+        for(auto i=0; i<degrees_of_freedom; ++i)
+            EXPECT_EQ( cast_ref<FEniCS::Vector>(v_.component(X.idMap(j))).get()[i], pow(10,j+1) + i );
+}
+
+TEST(FEniCSUtilCopy,FlatVectorArithmetic)
+{
+    auto v = test_vector_2D();
+    FEniCS::FlatVector x(V2D);
+    x.copyFrom(v);
+    auto y = x;
+
+    y *= 2;
+    y -= x;
+    y += x;
+    EXPECT_EQ( y(x), 2*x(x) );
+
+    x.copyTo(v);
+    EXPECT_EQ( x(x), get(v(v)) );
+}
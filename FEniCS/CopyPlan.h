@@ -0,0 +1,143 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <dolfin/function/Function.h>
+#include <dolfin/function/FunctionSpace.h>
+#include <dolfin/la/GenericVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "Dofmap.h"
+#include "LocalArray.h"
+#include "Parallel.h"
+#include "SubSpaces.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Precomputed gather/scatter between vectors of a Spacy space V and the mixed dolfin vector of a function space.
+     *
+     * Each leaf of V is described by its Dofmap, i.e. by offset and stride if the dofmap is affine and by a flat index array otherwise.
+     * Copies then run one loop over the process-local arrays per leaf, instead of a dofmap lookup and setitem per entry.
+     * The dofmaps are built on first use, or by warmup(). They are taken from the VectorCreators of V,
+     * such that the components are always read and written in their original numbering, never in one from renumber().
+     *
+     * Plans are owned by the caller, who keeps one per pair of spaces for as long as copies are done. V must outlive its plans.
+     */
+    class CopyPlan
+    {
+      struct Component
+      {
+        Component(std::vector<unsigned> path, const VectorCreator& creator, std::size_t firstLocalDof)
+          : path(std::move(path)), size(creator.size()), dofmap(creator, firstLocalDof)
+        {}
+
+        std::vector<unsigned> path;
+        std::size_t size;
+        LazyDofmap dofmap;
+      };
+
+    public:
+      CopyPlan(const VectorSpace& V, const dolfin::FunctionSpace& dolfinSpace)
+        : dimension_(dolfinSpace.dim())
+      {
+        const auto range = dolfinSpace.dofmap()->ownership_range();
+        const auto firstLocalDof = range.first;
+        localDimension_ = range.second - range.first;
+        for(const auto& subSpace : subSpaces(V))
+          components_.emplace_back(subSpace.path, creator<VectorCreator>(*subSpace.space), firstLocalDof);
+      }
+
+      /// Copy x to the mixed dolfin vector y, with up to numberOfThreads components copied concurrently for large vectors.
+      void copy(const ::Spacy::Vector& x, dolfin::GenericVector& y, unsigned numberOfThreads = 1) const
+      {
+        checkDimension(y);
+        LocalArray y_(y);
+        std::vector<std::unique_ptr<ConstLocalArray>> x_;
+        for(const auto& component : components_)
+        {
+          x_.push_back(std::make_unique<ConstLocalArray>(cast_ref<Vector>(FEniCS::component(x, component.path)).get()));
+          checkSize(*x_.back(), component);
+        }
+        parallelFor(components_.size(), numberOfThreadsFor(y_.size(), numberOfThreads),
+                    [&](std::size_t k) { components_[k].dofmap.get().scatter(x_[k]->data(), y_.data()); });
+      }
+
+      /// Copy the mixed dolfin vector y to x, with up to numberOfThreads components copied concurrently for large vectors.
+      void copy(const dolfin::GenericVector& y, ::Spacy::Vector& x, unsigned numberOfThreads = 1) const
+      {
+        checkDimension(y);
+        ConstLocalArray y_(y);
+        std::vector<std::unique_ptr<LocalArray>> x_;
+        for(const auto& component : components_)
+        {
+          x_.push_back(std::make_unique<LocalArray>(cast_ref<Vector>(FEniCS::component(x, component.path)).get()));
+          checkSize(*x_.back(), component);
+        }
+        parallelFor(components_.size(), numberOfThreadsFor(y_.size(), numberOfThreads),
+                    [&](std::size_t k) { components_[k].dofmap.get().gather(y_.data(), x_[k]->data()); });
+      }
+
+      void copy(const ::Spacy::Vector& x, dolfin::Function& y, unsigned numberOfThreads = 1) const
+      {
+        copy(x, *y.vector(), numberOfThreads);
+      }
+
+      void copy(const dolfin::Function& y, ::Spacy::Vector& x, unsigned numberOfThreads = 1) const
+      {
+        copy(*y.vector(), x, numberOfThreads);
+      }
+
+      /// Build all dofmaps now instead of on first copy.
+      void warmup() const
+      {
+        for(const auto& component : components_)
+          component.dofmap.warmup();
+      }
+
+      bool isInitialized() const
+      {
+        return std::all_of(begin(components_), end(components_),
+                           [](const Component& component) { return component.dofmap.isInitialized(); });
+      }
+
+      /// Number of bytes used by the dofmaps of this plan.
+      std::size_t memoryUsage() const
+      {
+        auto bytes = sizeof(*this);
+        for(const auto& component : components_)
+          bytes += component.dofmap.memoryUsage() + component.path.capacity()*sizeof(unsigned);
+        return bytes;
+      }
+
+    private:
+      void checkDimension(const dolfin::GenericVector& y) const
+      {
+        if( y.size() != dimension_ || y.local_size() != localDimension_ )
+          throw std::invalid_argument("CopyPlan: dolfin vector does not belong to the function space of this plan.");
+      }
+
+      template <class Array>
+      static void checkSize(const Array& x, const Component& component)
+      {
+        if( x.size() != component.size )
+          throw std::invalid_argument("CopyPlan: local size of component does not match its dofmap.");
+      }
+
+      std::size_t dimension_;
+      std::size_t localDimension_;
+      std::deque<Component> components_;
+    };
+  }
+}
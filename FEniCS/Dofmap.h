@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/fem/GenericDofMap.h>
+#include <dolfin/function/FunctionSpace.h>
+
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Map from the dofs of a sub-space to the dofs of its mixed function space.
+     *
+     * If the map is affine, i.e. dofmap(i) = offset + i*stride, as for the sub-spaces of interleaved mixed spaces, only offset and stride
+     * are stored and dofmap(i), inverseDofmap(i) are plain arithmetic. Otherwise the general table is kept, together with a dense inverse
+     * table over the range [min dofmap(i), max dofmap(i)]. The choice is made once on construction. Scalar, batched,
+     * scatter and gather operations then dispatch through a function pointer into loops that do not branch on it.
+     *
+     * The dofmap of a VectorCreator maps global dofs, hence only sub-spaces that are not distributed over several processes are supported.
+     */
+    class Dofmap
+    {
+    public:
+      /// Dofmap of creator, shifted such that firstLocalDof is mapped to 0.
+      explicit Dofmap(const VectorCreator& creator, std::size_t firstLocalDof = 0)
+      {
+        const auto range = creator.get()->dofmap()->ownership_range();
+        if( range.second - range.first != creator.size() )
+          throw std::invalid_argument("Dofmap: distributed function spaces are not supported.");
+        init(creator.size(), [&creator,firstLocalDof](std::size_t i) { return creator.dofmap(i) - firstLocalDof; });
+      }
+
+      explicit Dofmap(const std::vector<std::size_t>& table)
+      {
+        init(table.size(), [&table](std::size_t i) { return table[i]; });
+      }
+
+      std::size_t dofmap(std::size_t i) const
+      {
+        return kernels_->dofmap(*this, i);
+      }
+
+      std::size_t inverseDofmap(std::size_t i) const
+      {
+        return kernels_->inverseDofmap(*this, i);
+      }
+
+      /// out[k] = dofmap(in[k]) for k = 0, ..., size-1.
+      void dofmap(const std::size_t* in, std::size_t* out, std::size_t size) const
+      {
+        kernels_->dofmaps(*this, in, out, size);
+      }
+
+      /// out[k] = inverseDofmap(in[k]) for k = 0, ..., size-1.
+      void inverseDofmap(const std::size_t* in, std::size_t* out, std::size_t size) const
+      {
+        kernels_->inverseDofmaps(*this, in, out, size);
+      }
+
+      /// to[dofmap(i)] = from[i] for all dofs i of the sub-space.
+      void scatter(const double* from, double* to) const
+      {
+        kernels_->scatter(*this, from, to);
+      }
+
+      /// to[i] = from[dofmap(i)] for all dofs i of the sub-space.
+      void gather(const double* from, double* to) const
+      {
+        kernels_->gather(*this, from, to);
+      }
+
+      bool isAffine() const
+      {
+        return table_.empty();
+      }
+
+      std::size_t offset() const
+      {
+        return offset_;
+      }
+
+      std::size_t stride() const
+      {
+        return stride_;
+      }
+
+      std::size_t size() const
+      {
+        return size_;
+      }
+
+      /// Number of bytes used by this dofmap.
+      std::size_t memoryUsage() const
+      {
+        return sizeof(*this) + table_.capacity()*sizeof(std::size_t) + inverseTable_.capacity()*sizeof(std::size_t);
+      }
+
+    private:
+      template <class Map>
+      void init(std::size_t size, const Map& map)
+      {
+        size_ = size;
+        offset_ = size > 0 ? map(0) : 0;
+        stride_ = size > 1 && map(1) > offset_ ? map(1) - offset_ : 1;
+
+        auto affine = size < 2 || map(1) > offset_;
+        for(auto i=0u; affine && i<size; ++i)
+          affine = map(i) == offset_ + i*stride_;
+        if( affine )
+          return;
+
+        kernels_ = &kernels<Table>();
+        table_.resize(size);
+        for(auto i=0u; i<size; ++i)
+          table_[i] = map(i);
+
+        const auto range = std::minmax_element(begin(table_), end(table_));
+        inverseOffset_ = *range.first;
+        inverseTable_.assign(*range.second - inverseOffset_ + 1, invalid());
+        for(auto i=0u; i<size; ++i)
+          inverseTable_[table_[i] - inverseOffset_] = i;
+      }
+
+      /// Operations on the dofmap, chosen once on construction such that loops contain no branch on the kind of dofmap.
+      struct Kernels
+      {
+        std::size_t (*dofmap)(const Dofmap&, std::size_t);
+        std::size_t (*inverseDofmap)(const Dofmap&, std::size_t);
+        void (*dofmaps)(const Dofmap&, const std::size_t*, std::size_t*, std::size_t);
+        void (*inverseDofmaps)(const Dofmap&, const std::size_t*, std::size_t*, std::size_t);
+        void (*scatter)(const Dofmap&, const double*, double*);
+        void (*gather)(const Dofmap&, const double*, double*);
+      };
+
+      struct Affine
+      {
+        static std::size_t dofmap(const Dofmap& d, std::size_t i)
+        {
+          return d.offset_ + i*d.stride_;
+        }
+
+        static std::size_t inverseDofmap(const Dofmap& d, std::size_t i)
+        {
+          if( i < d.offset_ || (i - d.offset_) % d.stride_ != 0 || (i - d.offset_)/d.stride_ >= d.size_ )
+            throw std::out_of_range("Dofmap: index is not in the range of the dofmap.");
+          return (i - d.offset_)/d.stride_;
+        }
+      };
+
+      struct Table
+      {
+        static std::size_t dofmap(const Dofmap& d, std::size_t i)
+        {
+          return d.table_[i];
+        }
+
+        static std::size_t inverseDofmap(const Dofmap& d, std::size_t i)
+        {
+          if( i < d.inverseOffset_ || i - d.inverseOffset_ >= d.inverseTable_.size() || d.inverseTable_[i - d.inverseOffset_] == invalid() )
+            throw std::out_of_range("Dofmap: index is not in the range of the dofmap.");
+          return d.inverseTable_[i - d.inverseOffset_];
+        }
+      };
+
+      template <class Kind>
+      static void dofmaps(const Dofmap& d, const std::size_t* in, std::size_t* out, std::size_t size)
+      {
+        for(auto k=0u; k<size; ++k)
+          out[k] = Kind::dofmap(d, in[k]);
+      }
+
+      template <class Kind>
+      static void inverseDofmaps(const Dofmap& d, const std::size_t* in, std::size_t* out, std::size_t size)
+      {
+        for(auto k=0u; k<size; ++k)
+          out[k] = Kind::inverseDofmap(d, in[k]);
+      }
+
+      template <class Kind>
+      static void scatter(const Dofmap& d, const double* from, double* to)
+      {
+        for(auto i=0u; i<d.size_; ++i)
+          to[Kind::dofmap(d, i)] = from[i];
+      }
+
+      template <class Kind>
+      static void gather(const Dofmap& d, const double* from, double* to)
+      {
+        for(auto i=0u; i<d.size_; ++i)
+          to[i] = from[Kind::dofmap(d, i)];
+      }
+
+      template <class Kind>
+      static const Kernels& kernels()
+      {
+        static const Kernels kernels = { &Kind::dofmap, &Kind::inverseDofmap, &dofmaps<Kind>, &inverseDofmaps<Kind>,
+                                         &scatter<Kind>, &gather<Kind> };
+        return kernels;
+      }
+
+      static constexpr std::size_t invalid()
+      {
+        return std::numeric_limits<std::size_t>::max();
+      }
+
+      std::size_t size_ = 0;
+      std::size_t offset_ = 0;
+      std::size_t stride_ = 1;
+      std::vector<std::size_t> table_;
+      std::size_t inverseOffset_ = 0;
+      std::vector<std::size_t> inverseTable_;
+      const Kernels* kernels_ = &kernels<Affine>();
+    };
+
+    /**
+     * @brief Dofmap that is built on first access.
+     *
+     * Construction only stores the creator, which must outlive the first call to get(). Access is thread-safe.
+     */
+    class LazyDofmap
+    {
+    public:
+      explicit LazyDofmap(const VectorCreator& creator, std::size_t firstLocalDof = 0)
+        : creator_(&creator), firstLocalDof_(firstLocalDof)
+      {}
+
+      const Dofmap& get() const
+      {
+        std::call_once(flag_, [this]
+        {
+          dofmap_ = std::make_unique<Dofmap>(*creator_, firstLocalDof_);
+          initialized_ = true;
+        });
+        return *dofmap_;
+      }
+
+      /// Build the dofmap now instead of on first access.
+      void warmup() const
+      {
+        get();
+      }
+
+      bool isInitialized() const
+      {
+        return initialized_;
+      }
+
+      /// Number of bytes used by this dofmap, counting only what has been built yet.
+      std::size_t memoryUsage() const
+      {
+        return sizeof(*this) + (isInitialized() ? dofmap_->memoryUsage() : 0);
+      }
+
+    private:
+      const VectorCreator* creator_;
+      std::size_t firstLocalDof_;
+      mutable std::once_flag flag_;
+      mutable std::unique_ptr<Dofmap> dofmap_;
+      mutable std::atomic<bool> initialized_{false};
+    };
+  }
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <petscvec.h>
+
+#include <dolfin/la/PETScVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// PETSc vectors of the FEniCS vectors that make up x, in the component order of (nested) product space vectors.
+      inline void collectVecs(const ::Spacy::Vector& x, std::vector<Vec>& vecs)
+      {
+        if( is<ProductSpace::Vector>(x) )
+        {
+          const auto& x_ = cast_ref<ProductSpace::Vector>(x);
+          for(auto k=0u; k<x_.numberOfVariables(); ++k)
+            collectVecs(x_.component(k), vecs);
+          return;
+        }
+        vecs.push_back(dolfin::as_type<const dolfin::PETScVector>(cast_ref<Vector>(x).get()).vec());
+      }
+    }
+
+    /**
+     * @brief Computes results[k] = x(ys[k]) for k = 0, ..., n-1.
+     *
+     * Uses VecMDotBegin/VecMDotEnd per FEniCS component, such that x is read once per component
+     * and all pairings of the batch share a single MPI reduction.
+     */
+    inline void dualPairings(const ::Spacy::Vector& x, const ::Spacy::Vector* ys, std::size_t n, double* results)
+    {
+      if( n == 0 )
+        return;
+
+      std::vector<Vec> xVecs;
+      Detail::collectVecs(x, xVecs);
+      const auto numberOfComponents = xVecs.size();
+
+      // yVecs[l*n + k] is component l of ys[k]
+      std::vector<Vec> yVecs(numberOfComponents*n);
+      std::vector<Vec> vecs;
+      for(auto k=0u; k<n; ++k)
+      {
+        vecs.clear();
+        Detail::collectVecs(ys[k], vecs);
+        if( vecs.size() != numberOfComponents )
+          throw std::invalid_argument("dualPairings: vectors have different numbers of components.");
+        for(auto l=0u; l<numberOfComponents; ++l)
+          yVecs[l*n + k] = vecs[l];
+      }
+
+      std::vector<PetscScalar> partial(numberOfComponents*n);
+      for(auto l=0u; l<numberOfComponents; ++l)
+        VecMDotBegin(xVecs[l], n, &yVecs[l*n], &partial[l*n]);
+      for(auto l=0u; l<numberOfComponents; ++l)
+        VecMDotEnd(xVecs[l], n, &yVecs[l*n], &partial[l*n]);
+
+      for(auto k=0u; k<n; ++k)
+      {
+        results[k] = 0;
+        for(auto l=0u; l<numberOfComponents; ++l)
+          results[k] += partial[l*n + k];
+      }
+    }
+
+    inline std::vector<double> dualPairings(const ::Spacy::Vector& x, const std::vector<::Spacy::Vector>& ys)
+    {
+      std::vector<double> results(ys.size());
+      dualPairings(x, ys.data(), ys.size(), results.data());
+      return results;
+    }
+  }
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "ComponentView.h"
+#include "LocalArray.h"
+#include "SubSpaces.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Vector of a (possibly nested) product space of FEniCS spaces, with all leaves stored one after another in one buffer.
+     *
+     * The leaf with sub-space number id occupies the entries [offset(id), offset(id) + size(id)), such that component(id) is O(1)
+     * also for primal-dual spaces. Whole-vector arithmetic and dual pairings are single loops over the buffer.
+     * Values are exchanged with ::Spacy::Vector via copy, with one bulk transfer per leaf.
+     */
+    class FlatVector
+    {
+    public:
+      explicit FlatVector(const VectorSpace& V)
+      {
+        const auto leaves = subSpaces(V);
+        offsets_.assign(leaves.size() + 1, 0);
+        paths_.resize(leaves.size());
+        for(const auto& leaf : leaves)
+        {
+          if( leaf.id >= leaves.size() )
+            throw std::invalid_argument("FlatVector: sub-space numbers are not contiguous.");
+          offsets_[leaf.id + 1] = creator<VectorCreator>(*leaf.space).size();
+          paths_[leaf.id] = leaf.path;
+        }
+        for(auto k=0u; k<leaves.size(); ++k)
+          offsets_[k+1] += offsets_[k];
+        values_.assign(offsets_.back(), 0.);
+      }
+
+      /// Contiguous view onto the leaf with sub-space number id in the mixed dolfin::FunctionSpace.
+      ComponentView component(unsigned id)
+      {
+        return ComponentView(values_.data(), offsets_[id], 1, size(id));
+      }
+
+      std::size_t offset(unsigned id) const
+      {
+        return offsets_[id];
+      }
+
+      std::size_t size(unsigned id) const
+      {
+        return offsets_[id+1] - offsets_[id];
+      }
+
+      std::size_t numberOfComponents() const
+      {
+        return paths_.size();
+      }
+
+      FlatVector& operator+=(const FlatVector& y)
+      {
+        checkSize(y);
+        for(auto i=0u; i<values_.size(); ++i)
+          values_[i] += y.values_[i];
+        return *this;
+      }
+
+      FlatVector& operator-=(const FlatVector& y)
+      {
+        checkSize(y);
+        for(auto i=0u; i<values_.size(); ++i)
+          values_[i] -= y.values_[i];
+        return *this;
+      }
+
+      FlatVector& operator*=(double a)
+      {
+        for(auto& value : values_)
+          value *= a;
+        return *this;
+      }
+
+      /// Process-local dual pairing.
+      double operator()(const FlatVector& y) const
+      {
+        checkSize(y);
+        auto result = 0.;
+        for(auto i=0u; i<values_.size(); ++i)
+          result += values_[i]*y.values_[i];
+        return result;
+      }
+
+      /// Overwrite this with the values of x, which must be a vector of the space this was created from.
+      void copyFrom(const ::Spacy::Vector& x)
+      {
+        for(auto id=0u; id<paths_.size(); ++id)
+          getLocal(cast_ref<Vector>(FEniCS::component(x, paths_[id])), values_.data() + offsets_[id], size(id));
+      }
+
+      /// Overwrite x, which must be a vector of the space this was created from.
+      void copyTo(::Spacy::Vector& x) const
+      {
+        for(auto id=0u; id<paths_.size(); ++id)
+          setLocal(cast_ref<Vector>(FEniCS::component(x, paths_[id])), values_.data() + offsets_[id], size(id));
+      }
+
+      double* data()
+      {
+        return values_.data();
+      }
+
+      const double* data() const
+      {
+        return values_.data();
+      }
+
+      std::size_t size() const
+      {
+        return values_.size();
+      }
+
+    private:
+      void checkSize(const FlatVector& y) const
+      {
+        if( y.size() != size() )
+          throw std::invalid_argument("FlatVector: sizes do not match.");
+      }
+
+      std::vector<double> values_;
+      std::vector<std::size_t> offsets_;
+      std::vector<std::vector<unsigned>> paths_;
+    };
+  }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/mesh/Mesh.h>
+
+#include "KernelSupport.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /**
+       * @brief Vertex coordinates of n triangles in structure-of-arrays layout, coordinates[k*n + c] for k < 6.
+       *
+       * Reads the triangles cellIndices[0], ..., cellIndices[n-1] if given and first, ..., first+n-1 otherwise.
+       */
+      inline void fillCoordinates(const dolfin::Mesh& mesh, std::size_t first, std::size_t n, std::vector<double>& coordinates,
+                                  const std::size_t* cellIndices = nullptr)
+      {
+        coordinates.resize(6*n);
+        const auto& cells = mesh.cells();
+        for(auto c=0u; c<n; ++c)
+        {
+          const auto cell = cellIndices ? cellIndices[c] : first + c;
+          for(auto l=0u; l<3; ++l)
+          {
+            const auto* vertex = mesh.geometry().x(cells[3*cell + l]);
+            coordinates[(2*l)*n + c] = vertex[0];
+            coordinates[(2*l+1)*n + c] = vertex[1];
+          }
+        }
+      }
+
+      /**
+       * @brief Determinant and inverse K = [[K0, K1], [K2, K3]] of the Jacobian of the affine map onto triangle c.
+       *
+       * Evaluates the expressions in the same order as the code that ffc generates for P1 triangles.
+       */
+      SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+      inline void affineGeometry(const double* coordinates, std::size_t n, std::size_t c,
+                                 double& detJ, double& K0, double& K1, double& K2, double& K3)
+      {
+        SPACY_FENICS_NO_CONTRACT_BODY
+        static const double FE3_C0_D01_Q1[2] = { -1.0, 1.0 };
+
+        const double J_c0 = coordinates[0*n+c] * FE3_C0_D01_Q1[0] + coordinates[2*n+c] * FE3_C0_D01_Q1[1];
+        const double J_c3 = coordinates[1*n+c] * FE3_C0_D01_Q1[0] + coordinates[5*n+c] * FE3_C0_D01_Q1[1];
+        const double J_c1 = coordinates[0*n+c] * FE3_C0_D01_Q1[0] + coordinates[4*n+c] * FE3_C0_D01_Q1[1];
+        const double J_c2 = coordinates[1*n+c] * FE3_C0_D01_Q1[0] + coordinates[3*n+c] * FE3_C0_D01_Q1[1];
+        const double sp0 = J_c0 * J_c3;
+        const double sp1 = J_c1 * J_c2;
+        detJ = sp0 + -1 * sp1;
+        K0 = J_c3 / detJ;
+        K1 = -1 * J_c1 / detJ;
+        K2 = -1 * J_c2 / detJ;
+        K3 = J_c0 / detJ;
+      }
+
+      struct AffineGeometryKernel
+      {
+        SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+        static void run(double* __restrict geometry, std::size_t stride, const double* __restrict coordinates, std::size_t n)
+        {
+          SPACY_FENICS_INDEPENDENT_CELLS
+          for(std::size_t c=0; c<n; ++c)
+            affineGeometry(coordinates, n, c, geometry[0*stride+c], geometry[1*stride+c], geometry[2*stride+c],
+                           geometry[3*stride+c], geometry[4*stride+c]);
+        }
+      };
+    }
+
+    /**
+     * @brief Affine geometry of all cells of a triangle mesh in 2D.
+     *
+     * Stores, per cell, the determinant detJ and the inverse K of the Jacobian of the reference map in structure-of-arrays
+     * layout: data()[k*numberOfCells() + c] is detJ for k = 0 and K_{k-1} (row-major) for k = 1, ..., 4.
+     * Kernels that take this geometry instead of vertex coordinates skip the per-cell geometry computation.
+     *
+     * The geometry is a snapshot of the vertex coordinates and is owned by the caller, who must build a new one after
+     * the mesh has moved, e.g. by ALE::move.
+     */
+    class AffineGeometry
+    {
+    public:
+      explicit AffineGeometry(const dolfin::Mesh& mesh, std::size_t blockSize = 256)
+        : meshId_(mesh.id()), numberOfCells_(mesh.num_cells())
+      {
+        if( mesh.topology().dim() != 2 || mesh.geometry().dim() != 2 || mesh.geometry().degree() != 1 )
+          throw std::invalid_argument("AffineGeometry: requires an affine triangle mesh in 2D.");
+
+        values_.resize(5*numberOfCells_);
+        std::vector<double> coordinates;
+        for(std::size_t first=0; first<numberOfCells_; first+=blockSize)
+        {
+          const auto n = std::min(blockSize, numberOfCells_ - first);
+          Detail::fillCoordinates(mesh, first, n, coordinates);
+          Detail::run<Detail::AffineGeometryKernel>(bestInstructionSet(), values_.data() + first, numberOfCells_, coordinates.data(), n);
+        }
+      }
+
+      double detJ(std::size_t cell) const
+      {
+        return values_[cell];
+      }
+
+      /// Entry (i,j) of the inverse Jacobian of cell.
+      double K(std::size_t cell, unsigned i, unsigned j) const
+      {
+        return values_[(1 + 2*i + j)*numberOfCells_ + cell];
+      }
+
+      const double* data() const
+      {
+        return values_.data();
+      }
+
+      std::size_t numberOfCells() const
+      {
+        return numberOfCells_;
+      }
+
+      /// Checks if this geometry has been computed on mesh, judging from its id and number of cells.
+      bool isGeometryOf(const dolfin::Mesh& mesh) const
+      {
+        return mesh.id() == meshId_ && mesh.num_cells() == numberOfCells_;
+      }
+
+      std::size_t memoryUsage() const
+      {
+        return values_.capacity()*sizeof(double);
+      }
+
+    private:
+      std::size_t meshId_;
+      std::size_t numberOfCells_;
+      std::vector<double> values_;
+    };
+  }
+}
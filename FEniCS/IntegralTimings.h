@@ -0,0 +1,483 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ufc.h>
+
+#include <dolfin/fem/Form.h>
+#include <dolfin/mesh/MeshFunction.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// name as contents of a JSON string, i.e. with quotes, backslashes and control characters escaped.
+      inline std::string escapeJson(const std::string& name)
+      {
+        std::string result;
+        result.reserve(name.size());
+        for(auto c : name)
+        {
+          if( c == '"' || c == '\\' )
+          {
+            result += '\\';
+            result += c;
+          }
+          else if( static_cast<unsigned char>(c) < 0x20 )
+          {
+            char code[7];
+            std::snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned>(c));
+            result += code;
+          }
+          else
+            result += c;
+        }
+        return result;
+      }
+    }
+
+    /**
+     * @brief Latency statistics of one integral: number of calls, total time and a histogram for percentiles.
+     *
+     * Latencies are counted in a log-linear histogram with eight buckets per power of two nanoseconds, such that
+     * percentiles are exact up to 12.5%. All members may be called concurrently.
+     */
+    class IntegralTimer
+    {
+    public:
+      explicit IntegralTimer(std::string name)
+        : name_(std::move(name))
+      {
+        reset();
+      }
+
+      const std::string& name() const
+      {
+        return name_;
+      }
+
+      /// Records one call that started at start (relative to the epoch of IntegralTimings) and took duration nanoseconds.
+      void record(std::uint64_t start, std::uint64_t duration, bool trace, std::size_t maxTraceEvents)
+      {
+        calls_.fetch_add(1, std::memory_order_relaxed);
+        nanoseconds_.fetch_add(duration, std::memory_order_relaxed);
+        histogram_[bucket(duration)].fetch_add(1, std::memory_order_relaxed);
+        if( !trace )
+          return;
+        std::lock_guard<std::mutex> lock(traceMutex_);
+        if( trace_.size() < maxTraceEvents )
+          trace_.push_back({start, duration, std::hash<std::thread::id>()(std::this_thread::get_id())});
+      }
+
+      std::uint64_t calls() const
+      {
+        return calls_.load(std::memory_order_relaxed);
+      }
+
+      double totalSeconds() const
+      {
+        return 1e-9*nanoseconds_.load(std::memory_order_relaxed);
+      }
+
+      /// Upper bound of the latency in seconds below which a fraction p in [0,1] of the calls lies.
+      double percentile(double p) const
+      {
+        const auto n = calls();
+        if( n == 0 )
+          return 0.;
+        const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(std::min(std::max(p, 0.), 1.)*n)));
+        std::uint64_t count = 0;
+        for(auto i=0u; i<histogram_.size(); ++i)
+        {
+          count += histogram_[i].load(std::memory_order_relaxed);
+          if( count >= rank )
+            return 1e-9*upperBound(i);
+        }
+        return 1e-9*upperBound(histogram_.size() - 1);
+      }
+
+      /// Number of cells, i.e. calls of tabulate_tensor, per second spent in the integral.
+      double cellsPerSecond() const
+      {
+        const auto seconds = totalSeconds();
+        return seconds > 0 ? calls()/seconds : 0.;
+      }
+
+      void reset()
+      {
+        calls_ = 0;
+        nanoseconds_ = 0;
+        for(auto& count : histogram_)
+          count = 0;
+        std::lock_guard<std::mutex> lock(traceMutex_);
+        trace_.clear();
+      }
+
+      struct TraceEvent
+      {
+        std::uint64_t start, duration;
+        std::size_t thread;
+      };
+
+      std::vector<TraceEvent> traceEvents() const
+      {
+        std::lock_guard<std::mutex> lock(traceMutex_);
+        return trace_;
+      }
+
+    private:
+      static std::size_t bucket(std::uint64_t nanoseconds)
+      {
+        if( nanoseconds < 8 )
+          return nanoseconds;
+        auto exponent = 3u;
+        while( (nanoseconds >> (exponent + 1)) != 0 )
+          ++exponent;
+        return 8*(exponent - 2) + ((nanoseconds >> (exponent - 3)) & 7);
+      }
+
+      static double upperBound(std::size_t bucket)
+      {
+        if( bucket < 8 )
+          return bucket + 1.;
+        const auto exponent = bucket/8 + 2;
+        return std::ldexp(8. + bucket%8 + 1., static_cast<int>(exponent) - 3);
+      }
+
+      std::string name_;
+      std::atomic<std::uint64_t> calls_;
+      std::atomic<std::uint64_t> nanoseconds_;
+      std::array<std::atomic<std::uint64_t>, 8*62> histogram_;
+      mutable std::mutex traceMutex_;
+      std::vector<TraceEvent> trace_;
+    };
+
+    /**
+     * @brief Registry of the timers of all instrumented integrals (see TimedCellIntegral) of the process.
+     *
+     * Timing is disabled by default, in which case instrumented integrals only check one flag per call.
+     * Setting the environment variable SPACY_FENICS_INTEGRAL_TIMINGS (or SPACY_FENICS_INTEGRAL_TRACE) to a file name
+     * enables timing (and recording of trace events) and writes the results as JSON (or Chrome trace) at process exit.
+     */
+    class IntegralTimings
+    {
+    public:
+      enum class Format { JSON, ChromeTrace };
+
+      /// The registry is never destroyed, such that integrals and exit handlers may use it until the very end.
+      static IntegralTimings& instance()
+      {
+        static auto* timings = create();
+        return *timings;
+      }
+
+      static bool enabled()
+      {
+        return enabledFlag().load(std::memory_order_relaxed);
+      }
+
+      void enable(bool enabled = true)
+      {
+        enabledFlag() = enabled;
+      }
+
+      /// Additionally records the first maxTraceEvents calls of each integral for export as Chrome trace.
+      void recordTrace(bool record = true, std::size_t maxTraceEvents = 100000)
+      {
+        maxTraceEvents_.store(maxTraceEvents, std::memory_order_relaxed);
+        trace_ = record;
+      }
+
+      /// Timer of the given name, created on first use.
+      IntegralTimer& timer(const std::string& name)
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& timer = timers_[name];
+        if( !timer )
+          timer = std::make_unique<IntegralTimer>(name);
+        return *timer;
+      }
+
+      /// Time since the first use of the registry in nanoseconds.
+      std::uint64_t now() const
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+      }
+
+      void record(IntegralTimer& timer, std::uint64_t start, std::uint64_t duration)
+      {
+        timer.record(start, duration, trace_.load(std::memory_order_relaxed), maxTraceEvents_.load(std::memory_order_relaxed));
+      }
+
+      void reset()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(auto& timer : timers_)
+          timer.second->reset();
+      }
+
+      /// Calls, total time, percentiles and cells per second of each integral.
+      void writeJson(std::ostream& out) const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out << "{\n  \"integrals\": [";
+        auto first = true;
+        for(const auto& entry : timers_)
+        {
+          const auto& timer = *entry.second;
+          out << (first ? "\n" : ",\n") << "    { \"name\": \"" << Detail::escapeJson(timer.name()) << "\", \"calls\": " << timer.calls()
+              << ", \"total_s\": " << timer.totalSeconds() << ", \"p50_s\": " << timer.percentile(0.5)
+              << ", \"p90_s\": " << timer.percentile(0.9) << ", \"p99_s\": " << timer.percentile(0.99)
+              << ", \"max_s\": " << timer.percentile(1.) << ", \"cells_per_s\": " << timer.cellsPerSecond() << " }";
+          first = false;
+        }
+        out << "\n  ]\n}\n";
+      }
+
+      /// Recorded calls as complete events in the Chrome trace event format, e.g. for chrome://tracing.
+      void writeChromeTrace(std::ostream& out) const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out << "{\"traceEvents\":[";
+        auto first = true;
+        for(const auto& entry : timers_)
+          for(const auto& event : entry.second->traceEvents())
+          {
+            out << (first ? "\n" : ",\n") << "{\"name\":\"" << Detail::escapeJson(entry.first) << "\",\"cat\":\"integral\",\"ph\":\"X\",\"pid\":0,\"tid\":"
+                << event.thread % 1000000 << ",\"ts\":" << 1e-3*event.start << ",\"dur\":" << 1e-3*event.duration << "}";
+            first = false;
+          }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+      }
+
+      void write(const std::string& fileName, Format format) const
+      {
+        std::ofstream out(fileName);
+        if( !out )
+          throw std::runtime_error("IntegralTimings: cannot open " + fileName + ".");
+        if( format == Format::JSON )
+          writeJson(out);
+        else
+          writeChromeTrace(out);
+      }
+
+      /// Enables timing and writes the results to fileName at process exit.
+      void exportAtExit(const std::string& fileName, Format format = Format::JSON)
+      {
+        enable();
+        if( format == Format::ChromeTrace )
+          recordTrace();
+        std::lock_guard<std::mutex> lock(mutex_);
+        exports_.emplace_back(fileName, format);
+        if( !exitHandlerRegistered_ )
+          std::atexit([] { instance().writeExports(); });
+        exitHandlerRegistered_ = true;
+      }
+
+    private:
+      IntegralTimings()
+        : epoch_(std::chrono::steady_clock::now())
+      {}
+
+      static IntegralTimings* create()
+      {
+        auto* timings = new IntegralTimings;
+        if( const auto* fileName = std::getenv("SPACY_FENICS_INTEGRAL_TIMINGS") )
+          timings->exportAtExit(fileName, Format::JSON);
+        if( const auto* fileName = std::getenv("SPACY_FENICS_INTEGRAL_TRACE") )
+          timings->exportAtExit(fileName, Format::ChromeTrace);
+        return timings;
+      }
+
+      static std::atomic<bool>& enabledFlag()
+      {
+        static std::atomic<bool> flag{false};
+        return flag;
+      }
+
+      void writeExports() const
+      {
+        std::vector<std::pair<std::string, Format>> exports;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          exports = exports_;
+        }
+        for(const auto& target : exports)
+          try
+          {
+            write(target.first, target.second);
+          }
+          catch(const std::exception&)
+          {
+            // nothing sensible to do during exit
+          }
+      }
+
+      std::chrono::steady_clock::time_point epoch_;
+      mutable std::mutex mutex_;
+      std::map<std::string, std::unique_ptr<IntegralTimer>> timers_;
+      std::atomic<bool> trace_{false};
+      std::atomic<std::size_t> maxTraceEvents_{0};
+      std::vector<std::pair<std::string, IntegralTimings::Format>> exports_;
+      bool exitHandlerRegistered_ = false;
+    };
+
+    /// Cell integral that forwards to another one and records its latency in an IntegralTimer while timing is enabled.
+    class TimedCellIntegral : public ufc::cell_integral
+    {
+    public:
+      TimedCellIntegral(std::unique_ptr<const ufc::cell_integral> integral, IntegralTimer& timer)
+        : integral_(std::move(integral)),
+          timer_(timer)
+      {
+        if( !integral_ )
+          throw std::invalid_argument("TimedCellIntegral: integral must not be null.");
+      }
+
+      TimedCellIntegral(std::unique_ptr<const ufc::cell_integral> integral, const std::string& name)
+        : TimedCellIntegral(std::move(integral), IntegralTimings::instance().timer(name))
+      {}
+
+      const std::vector<bool>& enabled_coefficients() const override
+      {
+        return integral_->enabled_coefficients();
+      }
+
+      void tabulate_tensor(double* A, const double* const* w, const double* coordinate_dofs, int cell_orientation) const override
+      {
+        if( !IntegralTimings::enabled() )
+          return integral_->tabulate_tensor(A, w, coordinate_dofs, cell_orientation);
+
+        auto& timings = IntegralTimings::instance();
+        const auto start = timings.now();
+        integral_->tabulate_tensor(A, w, coordinate_dofs, cell_orientation);
+        timings.record(timer_, start, timings.now() - start);
+      }
+
+    private:
+      std::unique_ptr<const ufc::cell_integral> integral_;
+      IntegralTimer& timer_;
+    };
+
+    /**
+     * @brief Form that forwards to another ufc::form and instruments its cell integrals with TimedCellIntegral.
+     *
+     * The timers are named name/cell_integral_otherwise for the default integral and name/cell_integral_i for subdomain i.
+     */
+    class TimedForm : public ufc::form
+    {
+    public:
+      TimedForm(std::shared_ptr<const ufc::form> form, std::string name)
+        : form_(std::move(form)),
+          name_(std::move(name))
+      {
+        if( !form_ )
+          throw std::invalid_argument("TimedForm: form must not be null.");
+      }
+
+      const char* signature() const override { return form_->signature(); }
+      std::size_t rank() const override { return form_->rank(); }
+      std::size_t num_coefficients() const override { return form_->num_coefficients(); }
+      std::size_t original_coefficient_position(std::size_t i) const override { return form_->original_coefficient_position(i); }
+      ufc::finite_element* create_coordinate_finite_element() const override { return form_->create_coordinate_finite_element(); }
+      ufc::dofmap* create_coordinate_dofmap() const override { return form_->create_coordinate_dofmap(); }
+      ufc::coordinate_mapping* create_coordinate_mapping() const override { return form_->create_coordinate_mapping(); }
+      ufc::finite_element* create_finite_element(std::size_t i) const override { return form_->create_finite_element(i); }
+      ufc::dofmap* create_dofmap(std::size_t i) const override { return form_->create_dofmap(i); }
+
+      std::size_t max_cell_subdomain_id() const override { return form_->max_cell_subdomain_id(); }
+      std::size_t max_exterior_facet_subdomain_id() const override { return form_->max_exterior_facet_subdomain_id(); }
+      std::size_t max_interior_facet_subdomain_id() const override { return form_->max_interior_facet_subdomain_id(); }
+      std::size_t max_vertex_subdomain_id() const override { return form_->max_vertex_subdomain_id(); }
+      std::size_t max_custom_subdomain_id() const override { return form_->max_custom_subdomain_id(); }
+      std::size_t max_cutcell_subdomain_id() const override { return form_->max_cutcell_subdomain_id(); }
+      std::size_t max_interface_subdomain_id() const override { return form_->max_interface_subdomain_id(); }
+      std::size_t max_overlap_subdomain_id() const override { return form_->max_overlap_subdomain_id(); }
+
+      bool has_cell_integrals() const override { return form_->has_cell_integrals(); }
+      bool has_exterior_facet_integrals() const override { return form_->has_exterior_facet_integrals(); }
+      bool has_interior_facet_integrals() const override { return form_->has_interior_facet_integrals(); }
+      bool has_vertex_integrals() const override { return form_->has_vertex_integrals(); }
+      bool has_custom_integrals() const override { return form_->has_custom_integrals(); }
+      bool has_cutcell_integrals() const override { return form_->has_cutcell_integrals(); }
+      bool has_interface_integrals() const override { return form_->has_interface_integrals(); }
+      bool has_overlap_integrals() const override { return form_->has_overlap_integrals(); }
+
+      ufc::cell_integral* create_cell_integral(std::size_t subdomain_id) const override
+      {
+        return timed(form_->create_cell_integral(subdomain_id), "cell_integral_" + std::to_string(subdomain_id));
+      }
+
+      ufc::exterior_facet_integral* create_exterior_facet_integral(std::size_t i) const override { return form_->create_exterior_facet_integral(i); }
+      ufc::interior_facet_integral* create_interior_facet_integral(std::size_t i) const override { return form_->create_interior_facet_integral(i); }
+      ufc::vertex_integral* create_vertex_integral(std::size_t i) const override { return form_->create_vertex_integral(i); }
+      ufc::custom_integral* create_custom_integral(std::size_t i) const override { return form_->create_custom_integral(i); }
+      ufc::cutcell_integral* create_cutcell_integral(std::size_t i) const override { return form_->create_cutcell_integral(i); }
+      ufc::interface_integral* create_interface_integral(std::size_t i) const override { return form_->create_interface_integral(i); }
+      ufc::overlap_integral* create_overlap_integral(std::size_t i) const override { return form_->create_overlap_integral(i); }
+
+      ufc::cell_integral* create_default_cell_integral() const override
+      {
+        return timed(form_->create_default_cell_integral(), "cell_integral_otherwise");
+      }
+
+      ufc::exterior_facet_integral* create_default_exterior_facet_integral() const override { return form_->create_default_exterior_facet_integral(); }
+      ufc::interior_facet_integral* create_default_interior_facet_integral() const override { return form_->create_default_interior_facet_integral(); }
+      ufc::vertex_integral* create_default_vertex_integral() const override { return form_->create_default_vertex_integral(); }
+      ufc::custom_integral* create_default_custom_integral() const override { return form_->create_default_custom_integral(); }
+      ufc::cutcell_integral* create_default_cutcell_integral() const override { return form_->create_default_cutcell_integral(); }
+      ufc::interface_integral* create_default_interface_integral() const override { return form_->create_default_interface_integral(); }
+      ufc::overlap_integral* create_default_overlap_integral() const override { return form_->create_default_overlap_integral(); }
+
+    private:
+      ufc::cell_integral* timed(ufc::cell_integral* integral, const std::string& suffix) const
+      {
+        if( !integral )
+          return nullptr;
+        return new TimedCellIntegral(std::unique_ptr<const ufc::cell_integral>(integral), name_ + "/" + suffix);
+      }
+
+      std::shared_ptr<const ufc::form> form_;
+      std::string name_;
+    };
+
+    /**
+     * @brief Copy of form whose cell integrals are timed under the given name (see TimedForm).
+     *
+     * The copy refers to the same function spaces, coefficients, mesh and subdomain markers as form; later changes of
+     * the coefficients or markers of form are not reflected.
+     */
+    inline std::shared_ptr<dolfin::Form> timed(const dolfin::Form& form, const std::string& name)
+    {
+      auto result = std::make_shared<dolfin::Form>(std::make_shared<TimedForm>(form.ufc_form(), name), form.function_spaces());
+      for(auto i=0u; i<form.num_coefficients(); ++i)
+        result->set_coefficient(i, form.coefficient(i));
+      result->set_mesh(form.mesh());
+      result->set_cell_domains(form.cell_domains());
+      result->set_exterior_facet_domains(form.exterior_facet_domains());
+      result->set_interior_facet_domains(form.interior_facet_domains());
+      result->set_vertex_domains(form.vertex_domains());
+      return result;
+    }
+  }
+}
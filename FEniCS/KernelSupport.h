@@ -0,0 +1,84 @@
+#pragma once
+
+// Batched kernels must round exactly like the generated per-cell code, which forbids contracting a*b+c into fused multiply-adds.
+#if defined(__clang__)
+#define SPACY_FENICS_NO_CONTRACT
+#define SPACY_FENICS_NO_CONTRACT_BODY _Pragma("clang fp contract(off)")
+#elif defined(__GNUC__)
+#define SPACY_FENICS_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#define SPACY_FENICS_NO_CONTRACT_BODY
+#else
+#define SPACY_FENICS_NO_CONTRACT
+#define SPACY_FENICS_NO_CONTRACT_BODY
+#endif
+
+// The rows A[i*n + c] of the element tensors share one base pointer, which the compiler cannot prove free of overlap.
+#if defined(__clang__)
+#define SPACY_FENICS_INDEPENDENT_CELLS _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define SPACY_FENICS_INDEPENDENT_CELLS _Pragma("GCC ivdep")
+#else
+#define SPACY_FENICS_INDEPENDENT_CELLS
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SPACY_FENICS_X86_DISPATCH 1
+#define SPACY_FENICS_INLINE_BODY __attribute__((always_inline))
+#else
+#define SPACY_FENICS_X86_DISPATCH 0
+#define SPACY_FENICS_INLINE_BODY
+#endif
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /// Instruction sets for which the batched kernels are compiled.
+    enum class InstructionSet { Generic, AVX2, AVX512 };
+
+    /// Best instruction set supported by the executing CPU.
+    inline InstructionSet bestInstructionSet()
+    {
+#if SPACY_FENICS_X86_DISPATCH
+      static const auto best = __builtin_cpu_supports("avx512f") ? InstructionSet::AVX512
+                             : __builtin_cpu_supports("avx2") ? InstructionSet::AVX2 : InstructionSet::Generic;
+      return best;
+#else
+      return InstructionSet::Generic;
+#endif
+    }
+
+    namespace Detail
+    {
+#if SPACY_FENICS_X86_DISPATCH
+      template <class Kernel, class... Args>
+      SPACY_FENICS_NO_CONTRACT __attribute__((target("avx2")))
+      void runAvx2(Args... args)
+      {
+        Kernel::run(args...);
+      }
+
+      template <class Kernel, class... Args>
+      SPACY_FENICS_NO_CONTRACT __attribute__((target("avx512f")))
+      void runAvx512(Args... args)
+      {
+        Kernel::run(args...);
+      }
+#endif
+
+      /// Runs Kernel::run, which must be declared SPACY_FENICS_INLINE_BODY, compiled for the given instruction set.
+      template <class Kernel, class... Args>
+      SPACY_FENICS_NO_CONTRACT
+      void run(InstructionSet instructionSet, Args... args)
+      {
+#if SPACY_FENICS_X86_DISPATCH
+        if( instructionSet == InstructionSet::AVX512 )
+          return runAvx512<Kernel>(args...);
+        if( instructionSet == InstructionSet::AVX2 )
+          return runAvx2<Kernel>(args...);
+#endif
+        Kernel::run(args...);
+      }
+    }
+  }
+}
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+#include <petscvec.h>
+
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/la/PETScVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+#include "LocalArray.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Unevaluated linear combination a_0*x_0 + ... + a_{N-1}*x_{N-1} of FEniCS or product space vectors.
+     *
+     * Built with term(x) and the usual operators, e.g. term(x) + a*term(dx) - b*term(g), and evaluated by assign(y, ...)
+     * in one pass over the process-local arrays, without temporaries. The referenced vectors must outlive the expression.
+     */
+    template <std::size_t N>
+    struct LinearCombination
+    {
+      std::array<double, N> coefficients;
+      std::array<const ::Spacy::Vector*, N> vectors;
+    };
+
+    inline LinearCombination<1> term(const ::Spacy::Vector& x)
+    {
+      return { {{1.}}, {{&x}} };
+    }
+
+    template <std::size_t N>
+    LinearCombination<N> operator*(double a, LinearCombination<N> x)
+    {
+      for(auto& coefficient : x.coefficients)
+        coefficient *= a;
+      return x;
+    }
+
+    template <std::size_t N>
+    LinearCombination<N> operator-(const LinearCombination<N>& x)
+    {
+      return -1. * x;
+    }
+
+    template <std::size_t N, std::size_t M>
+    LinearCombination<N+M> operator+(const LinearCombination<N>& x, const LinearCombination<M>& y)
+    {
+      LinearCombination<N+M> result;
+      for(auto k=0u; k<N; ++k)
+      {
+        result.coefficients[k] = x.coefficients[k];
+        result.vectors[k] = x.vectors[k];
+      }
+      for(auto k=0u; k<M; ++k)
+      {
+        result.coefficients[N+k] = y.coefficients[k];
+        result.vectors[N+k] = y.vectors[k];
+      }
+      return result;
+    }
+
+    template <std::size_t N, std::size_t M>
+    LinearCombination<N+M> operator-(const LinearCombination<N>& x, const LinearCombination<M>& y)
+    {
+      return x + (-y);
+    }
+
+    namespace Detail
+    {
+      /// Read access to the process-local arrays of N PETSc vectors, reusing the write access to y where a vector aliases it.
+      template <std::size_t N>
+      class ReadArrays
+      {
+      public:
+        ReadArrays(const std::array<const dolfin::GenericVector*, N>& vectors, const dolfin::GenericVector& y, double* yData, std::size_t size)
+        {
+          for(auto k=0u; k<N; ++k)
+          {
+            if( vectors[k] == &y )
+            {
+              vecs_[k] = nullptr;
+              data_[k] = yData;
+              continue;
+            }
+            vecs_[k] = dolfin::as_type<const dolfin::PETScVector>(*vectors[k]).vec();
+            PetscInt localSize = 0;
+            VecGetLocalSize(vecs_[k], &localSize);
+            if( std::size_t(localSize) != size )
+            {
+              release(k);
+              throw std::invalid_argument("assign: local sizes of vectors in linear combination do not match.");
+            }
+            VecGetArrayRead(vecs_[k], &data_[k]);
+          }
+        }
+
+        ReadArrays(const ReadArrays&) = delete;
+        ReadArrays& operator=(const ReadArrays&) = delete;
+
+        ~ReadArrays()
+        {
+          release(N);
+        }
+
+        const double* operator[](std::size_t k) const
+        {
+          return data_[k];
+        }
+
+      private:
+        void release(std::size_t n)
+        {
+          for(auto k=0u; k<n; ++k)
+            if( vecs_[k] != nullptr )
+              VecRestoreArrayRead(vecs_[k], &data_[k]);
+        }
+
+        std::array<Vec, N> vecs_;
+        std::array<const double*, N> data_;
+      };
+    }
+
+    /// Evaluate y = a_0*x_0 + ... + a_{N-1}*x_{N-1} in a single fused loop. y may coincide with any of the x_k.
+    template <std::size_t N>
+    void assign(::Spacy::Vector& y, const LinearCombination<N>& x)
+    {
+      if( is<ProductSpace::Vector>(y) )
+      {
+        auto& y_ = cast_ref<ProductSpace::Vector>(y);
+        for(auto k=0u; k<y_.numberOfVariables(); ++k)
+        {
+          auto x_k = x;
+          for(auto& vector : x_k.vectors)
+            vector = &cast_ref<ProductSpace::Vector>(*vector).component(k);
+          assign(y_.component(k), x_k);
+        }
+        return;
+      }
+
+      auto& y_ = cast_ref<Vector>(y).get();
+      std::array<const dolfin::GenericVector*, N> vectors;
+      for(auto k=0u; k<N; ++k)
+        vectors[k] = &cast_ref<Vector>(*x.vectors[k]).get();
+
+      LocalArray yArray(y_);
+      const auto size = yArray.size();
+      const Detail::ReadArrays<N> xArrays(vectors, y_, yArray.data(), size);
+      auto* data = yArray.data();
+      for(auto i=0u; i<size; ++i)
+      {
+        auto value = 0.;
+        for(auto k=0u; k<N; ++k)
+          value += x.coefficients[k] * xArrays[k][i];
+        data[i] = value;
+      }
+    }
+  }
+}
@@ -0,0 +1,623 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/fem/AssemblerBase.h>
+#include <dolfin/function/Function.h>
+#include <dolfin/la/GenericMatrix.h>
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/mesh/Mesh.h>
+
+#include "CongruentCells.h"
+#include "GeometryCache.h"
+#include "KernelSupport.h"
+#include "LinearHeat.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Batched element tensors for the forms of LinearHeat.ufl on triangles.
+     *
+     * The kernels evaluate the same expressions in the same order as the per-cell code that ffc generates in LinearHeat.h
+     * and thus produce bit-identical element tensors, but process n cells per call in structure-of-arrays layout,
+     * such that the compiler vectorises across cells.
+     * Array layout: coordinates[k*n + c] is coordinate_dofs[k] of cell c, k < 6. Coefficient values and element tensors
+     * are stored in the same way, i.e. A[i*n + c] is entry i of the element tensor of cell c. A must not overlap the input arrays.
+     * The overloads taking an AffineGeometry read detJ and K of the cells first, ..., first+n-1 from the cache instead
+     * of computing them from the coordinates.
+     */
+    namespace LinearHeatKernels
+    {
+      namespace Detail
+      {
+        using FEniCS::Detail::affineGeometry;
+
+        /// Element vector of Form_F for cell c.
+        SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+        inline void residual(double* A, const double* f, const double* x, std::size_t n, std::size_t c,
+                             double detJ, double K0, double K1, double K2, double K3)
+        {
+          SPACY_FENICS_NO_CONTRACT_BODY
+          static const double weights3[3] = { 0.1666666666666667, 0.1666666666666667, 0.1666666666666667 };
+          static const double FE3_C0_D01_Q3[2] = { -1.0, 1.0 };
+          static const double FE3_C0_Q3[3][3] =
+              { { 0.6666666666666669, 0.1666666666666666, 0.1666666666666667 },
+                { 0.1666666666666667, 0.1666666666666666, 0.6666666666666665 },
+                { 0.1666666666666667, 0.6666666666666665, 0.1666666666666666 } };
+
+          const double w1_d1 = x[0*n+c] * FE3_C0_D01_Q3[0] + x[2*n+c] * FE3_C0_D01_Q3[1];
+          double w1_d0 = 0.0;
+          for(int ic = 0; ic < 2; ++ic)
+            w1_d0 += x[ic*n+c] * FE3_C0_D01_Q3[ic];
+          double sp[22];
+          sp[3] = K3;
+          sp[4] = K1;
+          sp[5] = w1_d1 * sp[3];
+          sp[6] = w1_d0 * sp[4];
+          sp[7] = sp[5] + sp[6];
+          sp[8] = sp[7] * sp[3];
+          sp[9] = sp[7] * sp[4];
+          sp[10] = K0;
+          sp[11] = K2;
+          sp[12] = w1_d0 * sp[10];
+          sp[13] = w1_d1 * sp[11];
+          sp[14] = sp[12] + sp[13];
+          sp[15] = sp[14] * sp[11];
+          sp[16] = sp[14] * sp[10];
+          sp[17] = sp[8] + sp[15];
+          sp[18] = sp[16] + sp[9];
+          sp[19] = std::abs(detJ);
+          sp[20] = sp[17] * sp[19];
+          sp[21] = sp[18] * sp[19];
+          double BF0[3] = {};
+          for(int iq = 0; iq < 3; ++iq)
+          {
+            double w0 = 0.0;
+            for(int ic = 0; ic < 3; ++ic)
+              w0 += f[ic*n+c] * FE3_C0_Q3[iq][ic];
+            const double sv3 = -1 * w0 * sp[19];
+            const double fw0 = sv3 * weights3[iq];
+            for(int i = 0; i < 3; ++i)
+              BF0[i] += fw0 * FE3_C0_Q3[iq][i];
+          }
+          A[0*n+c] = -0.5 * sp[21] + -0.5 * sp[20];
+          A[1*n+c] = 0.5 * sp[21];
+          A[2*n+c] = 0.5 * sp[20];
+          for(int i = 0; i < 3; ++i)
+            A[i*n+c] += BF0[i];
+        }
+
+        /// Geometry factors sp[17], sp[18], sp[19] of the generated Form_J kernel, which determine its element matrix.
+        SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+        inline void jacobianFactors(double detJ, double K0, double K1, double K2, double K3, double& G0, double& G1, double& G2)
+        {
+          SPACY_FENICS_NO_CONTRACT_BODY
+          double sp[20];
+          sp[3] = K3;
+          sp[4] = K1;
+          sp[5] = sp[3] * sp[3];
+          sp[6] = sp[3] * sp[4];
+          sp[7] = sp[4] * sp[4];
+          sp[8] = K0;
+          sp[9] = K2;
+          sp[10] = sp[9] * sp[9];
+          sp[11] = sp[8] * sp[9];
+          sp[12] = sp[8] * sp[8];
+          sp[13] = sp[5] + sp[10];
+          sp[14] = sp[6] + sp[11];
+          sp[15] = sp[12] + sp[7];
+          sp[16] = std::abs(detJ);
+          sp[17] = sp[13] * sp[16];
+          sp[18] = sp[14] * sp[16];
+          sp[19] = sp[15] * sp[16];
+          G0 = sp[17];
+          G1 = sp[18];
+          G2 = sp[19];
+        }
+
+        /// Element matrix of Form_J for cell c from its geometry factors.
+        SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+        inline void jacobianEntries(double* A, std::size_t n, std::size_t c, double sp17, double sp18, double sp19)
+        {
+          SPACY_FENICS_NO_CONTRACT_BODY
+          A[0*n+c] = 0.5 * sp19 + 0.5 * sp18 + 0.5 * sp18 + 0.5 * sp17;
+          A[1*n+c] = -0.5 * sp19 + -0.5 * sp18;
+          A[2*n+c] = -0.5 * sp18 + -0.5 * sp17;
+          A[3*n+c] = -0.5 * sp19 + -0.5 * sp18;
+          A[4*n+c] = 0.5 * sp19;
+          A[5*n+c] = 0.5 * sp18;
+          A[6*n+c] = -0.5 * sp18 + -0.5 * sp17;
+          A[7*n+c] = 0.5 * sp18;
+          A[8*n+c] = 0.5 * sp17;
+        }
+
+        struct ResidualKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict A, const double* __restrict f, const double* __restrict x,
+                          const double* __restrict coordinates, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              double detJ, K0, K1, K2, K3;
+              affineGeometry(coordinates, n, c, detJ, K0, K1, K2, K3);
+              residual(A, f, x, n, c, detJ, K0, K1, K2, K3);
+            }
+          }
+        };
+
+        struct ResidualFromGeometryKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict A, const double* __restrict f, const double* __restrict x,
+                          const double* __restrict geometry, std::size_t stride, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+              residual(A, f, x, n, c, geometry[0*stride+c], geometry[1*stride+c], geometry[2*stride+c],
+                       geometry[3*stride+c], geometry[4*stride+c]);
+          }
+        };
+
+        struct JacobianKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict A, const double* __restrict coordinates, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              double detJ, K0, K1, K2, K3, G0, G1, G2;
+              affineGeometry(coordinates, n, c, detJ, K0, K1, K2, K3);
+              jacobianFactors(detJ, K0, K1, K2, K3, G0, G1, G2);
+              jacobianEntries(A, n, c, G0, G1, G2);
+            }
+          }
+        };
+
+        struct JacobianFromGeometryKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict A, const double* __restrict geometry, std::size_t stride, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              double G0, G1, G2;
+              jacobianFactors(geometry[0*stride+c], geometry[1*stride+c], geometry[2*stride+c], geometry[3*stride+c],
+                              geometry[4*stride+c], G0, G1, G2);
+              jacobianEntries(A, n, c, G0, G1, G2);
+            }
+          }
+        };
+
+        struct ResidualAndJacobianKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict AF, double* __restrict AJ, const double* __restrict f, const double* __restrict x,
+                          const double* __restrict coordinates, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              double detJ, K0, K1, K2, K3, G0, G1, G2;
+              affineGeometry(coordinates, n, c, detJ, K0, K1, K2, K3);
+              residual(AF, f, x, n, c, detJ, K0, K1, K2, K3);
+              jacobianFactors(detJ, K0, K1, K2, K3, G0, G1, G2);
+              jacobianEntries(AJ, n, c, G0, G1, G2);
+            }
+          }
+        };
+
+        struct ResidualAndJacobianFromGeometryKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict AF, double* __restrict AJ, const double* __restrict f, const double* __restrict x,
+                          const double* __restrict geometry, std::size_t stride, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              const double detJ = geometry[0*stride+c], K0 = geometry[1*stride+c], K1 = geometry[2*stride+c],
+                           K2 = geometry[3*stride+c], K3 = geometry[4*stride+c];
+              double G0, G1, G2;
+              residual(AF, f, x, n, c, detJ, K0, K1, K2, K3);
+              jacobianFactors(detJ, K0, K1, K2, K3, G0, G1, G2);
+              jacobianEntries(AJ, n, c, G0, G1, G2);
+            }
+          }
+        };
+
+        struct JacobianFactorsKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict G, const double* __restrict coordinates, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+            {
+              double detJ, K0, K1, K2, K3;
+              affineGeometry(coordinates, n, c, detJ, K0, K1, K2, K3);
+              jacobianFactors(detJ, K0, K1, K2, K3, G[0*n+c], G[1*n+c], G[2*n+c]);
+            }
+          }
+        };
+
+        struct JacobianEntriesKernel
+        {
+          SPACY_FENICS_NO_CONTRACT SPACY_FENICS_INLINE_BODY
+          static void run(double* __restrict A, const double* __restrict G, std::size_t n)
+          {
+            SPACY_FENICS_INDEPENDENT_CELLS
+            for(std::size_t c=0; c<n; ++c)
+              jacobianEntries(A, n, c, G[0*n+c], G[1*n+c], G[2*n+c]);
+          }
+        };
+      }
+
+      /// Element vectors of Form_F with coefficients f and x for n cells.
+      inline void tabulateF(double* A, const double* f, const double* x, const double* coordinates, std::size_t n,
+                            InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::ResidualKernel>(instructionSet, A, f, x, coordinates, n);
+      }
+
+      /// Element vectors of Form_F with coefficients f and x for the cells first, ..., first+n-1 of the mesh of geometry.
+      inline void tabulateF(double* A, const double* f, const double* x, const AffineGeometry& geometry, std::size_t first, std::size_t n,
+                            InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::ResidualFromGeometryKernel>(instructionSet, A, f, x, geometry.data() + first, geometry.numberOfCells(), n);
+      }
+
+      /// Element matrices of Form_J for n cells.
+      inline void tabulateJ(double* A, const double* coordinates, std::size_t n, InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::JacobianKernel>(instructionSet, A, coordinates, n);
+      }
+
+      /// Element matrices of Form_J for the cells first, ..., first+n-1 of the mesh of geometry.
+      inline void tabulateJ(double* A, const AffineGeometry& geometry, std::size_t first, std::size_t n,
+                            InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::JacobianFromGeometryKernel>(instructionSet, A, geometry.data() + first, geometry.numberOfCells(), n);
+      }
+
+      /// Element vectors of Form_F and element matrices of Form_J for n cells, computing the geometry of each cell once.
+      inline void tabulateFJ(double* AF, double* AJ, const double* f, const double* x, const double* coordinates, std::size_t n,
+                             InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::ResidualAndJacobianKernel>(instructionSet, AF, AJ, f, x, coordinates, n);
+      }
+
+      /// Element vectors of Form_F and element matrices of Form_J for the cells first, ..., first+n-1 of the mesh of geometry.
+      inline void tabulateFJ(double* AF, double* AJ, const double* f, const double* x, const AffineGeometry& geometry,
+                             std::size_t first, std::size_t n, InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::ResidualAndJacobianFromGeometryKernel>(instructionSet, AF, AJ, f, x, geometry.data() + first,
+                                                                           geometry.numberOfCells(), n);
+      }
+
+      /**
+       * @brief Geometry factors of Form_J for n cells, G[k*n + c] with k < 3.
+       *
+       * The element matrix of Form_J depends on the cell only through these three factors, such that caching them
+       * instead of the element matrices reduces the memory per cell from nine to three doubles.
+       */
+      inline void tabulateJFactors(double* G, const double* coordinates, std::size_t n, InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::JacobianFactorsKernel>(instructionSet, G, coordinates, n);
+      }
+
+      /// Element matrices of Form_J for n cells from the geometry factors computed by tabulateJFactors.
+      inline void tabulateJFromFactors(double* A, const double* G, std::size_t n, InstructionSet instructionSet = bestInstructionSet())
+      {
+        FEniCS::Detail::run<Detail::JacobianEntriesKernel>(instructionSet, A, G, n);
+      }
+
+      /**
+       * @brief Assembles Form_F and Form_J of LinearHeat.ufl block-wise through the batched kernels.
+       *
+       * Requires a triangle mesh with affine geometry and coefficients f and x that are dolfin::Functions.
+       * The affine geometry of the mesh is either given on construction, then shared by all assemblies and owned by the caller,
+       * who must replace it after the mesh has moved, or computed anew in each assembly.
+       * With reuseCongruentCells, Form_J is tabulated only once per class of congruent cells (see CongruentCells) and
+       * the element matrices are scattered from there. This pays off on structured meshes, where the number of classes is tiny;
+       * the entries then agree with the ones of dolfin::Assembler up to the tolerance of CongruentCells. The classes share the
+       * lifetime of the given geometry, i.e. they are computed once per assembler, or in each assembly if no geometry is given.
+       * For Newton steps, both forms can be assembled in one traversal of the mesh that shares geometry and coefficient values.
+       * Tensors are initialized and finalized like with dolfin::Assembler.
+       */
+      class Assembler : public dolfin::AssemblerBase
+      {
+      public:
+        explicit Assembler(std::size_t blockSize = 256, bool reuseCongruentCells = false)
+          : blockSize_(std::max<std::size_t>(blockSize, 1)),
+            reuseCongruentCells_(reuseCongruentCells)
+        {}
+
+        /// Assembler that reads the geometry of the cells from geometry, which must belong to the mesh of the assembled forms.
+        explicit Assembler(std::shared_ptr<const AffineGeometry> geometry, std::size_t blockSize = 256, bool reuseCongruentCells = false)
+          : Assembler(blockSize, reuseCongruentCells)
+        {
+          geometry_ = std::move(geometry);
+        }
+
+        void assemble(dolfin::GenericVector& b, const LinearHeat::Form_F& F)
+        {
+          const auto& mesh = checkMesh(F);
+          const auto f = function(F, 0);
+          const auto x = function(F, 1);
+          init_global_tensor(b, F);
+
+          const auto& dofmap = *F.function_space(0)->dofmap();
+          const auto geometry = geometryOf(mesh);
+          Coefficients coefficients(*f, *x, blockSize_);
+          std::vector<double> A(3*blockSize_), cellValues(3);
+          for(std::size_t first=0; first<mesh.num_cells(); first+=blockSize_)
+          {
+            const auto n = std::min(blockSize_, mesh.num_cells() - first);
+            coefficients.gather(first, n);
+            tabulateF(A.data(), coefficients.f(), coefficients.x(), *geometry, first, n);
+
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto dofs = dofmap.cell_dofs(first + c);
+              for(auto i=0u; i<3; ++i)
+                cellValues[i] = A[i*n+c];
+              b.add_local(cellValues.data(), dofs.size(), dofs.data());
+            }
+          }
+          if( finalize_tensor )
+            b.apply("add");
+        }
+
+        void assemble(dolfin::GenericMatrix& M, const LinearHeat::Form_J& J)
+        {
+          const auto& mesh = checkMesh(J);
+          init_global_tensor(M, J);
+
+          const auto& rowDofmap = *J.function_space(0)->dofmap();
+          const auto& columnDofmap = *J.function_space(1)->dofmap();
+          if( reuseCongruentCells_ )
+            return assembleCongruent(M, mesh, rowDofmap, columnDofmap);
+
+          const auto geometry = geometryOf(mesh);
+          std::vector<double> A(9*blockSize_), cellValues(9);
+          for(std::size_t first=0; first<mesh.num_cells(); first+=blockSize_)
+          {
+            const auto n = std::min(blockSize_, mesh.num_cells() - first);
+            tabulateJ(A.data(), *geometry, first, n);
+
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto rows = rowDofmap.cell_dofs(first + c);
+              const auto columns = columnDofmap.cell_dofs(first + c);
+              for(auto i=0u; i<9; ++i)
+                cellValues[i] = A[i*n+c];
+              M.add_local(cellValues.data(), rows.size(), rows.data(), columns.size(), columns.data());
+            }
+          }
+          if( finalize_tensor )
+            M.apply("add");
+        }
+
+        /**
+         * @brief Assembles F into b and J into M in one traversal of the mesh, e.g. for a Newton step.
+         *
+         * Both forms must live on the same mesh. Geometry, coefficient values and cell dofs are read once per cell
+         * and shared by both element tensors, which agree with the ones of the separate assemblies.
+         */
+        void assemble(dolfin::GenericVector& b, dolfin::GenericMatrix& M, const LinearHeat::Form_F& F, const LinearHeat::Form_J& J)
+        {
+          const auto& mesh = checkMesh(F);
+          if( checkMesh(J).id() != mesh.id() )
+            throw std::invalid_argument("LinearHeatKernels::Assembler: Form_F and Form_J must be defined on the same mesh.");
+          const auto f = function(F, 0);
+          const auto x = function(F, 1);
+          init_global_tensor(b, F);
+          init_global_tensor(M, J);
+
+          const auto& dofmap = *F.function_space(0)->dofmap();
+          const auto& rowDofmap = *J.function_space(0)->dofmap();
+          const auto& columnDofmap = *J.function_space(1)->dofmap();
+          const auto sharedRows = &rowDofmap == &dofmap;
+          const auto sharedColumns = &columnDofmap == &rowDofmap;
+          const auto geometry = geometryOf(mesh);
+          const auto congruence = reuseCongruentCells_ ? congruenceOf(mesh) : nullptr;
+
+          Coefficients coefficients(*f, *x, blockSize_);
+          std::vector<double> AF(3*blockSize_), AJ(reuseCongruentCells_ ? 0 : 9*blockSize_), vectorValues(3), matrixValues(9);
+          for(std::size_t first=0; first<mesh.num_cells(); first+=blockSize_)
+          {
+            const auto n = std::min(blockSize_, mesh.num_cells() - first);
+            coefficients.gather(first, n);
+            if( reuseCongruentCells_ )
+              tabulateF(AF.data(), coefficients.f(), coefficients.x(), *geometry, first, n);
+            else
+              tabulateFJ(AF.data(), AJ.data(), coefficients.f(), coefficients.x(), *geometry, first, n);
+
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto cell = first + c;
+              const auto dofs = dofmap.cell_dofs(cell);
+              for(auto i=0u; i<3; ++i)
+                vectorValues[i] = AF[i*n+c];
+              b.add_local(vectorValues.data(), dofs.size(), dofs.data());
+
+              const auto rows = sharedRows ? dofs : rowDofmap.cell_dofs(cell);
+              const auto columns = sharedColumns ? rows : columnDofmap.cell_dofs(cell);
+              const double* cellMatrix = matrixValues.data();
+              if( congruence )
+                cellMatrix = congruence->tensor(cell);
+              else
+                for(auto i=0u; i<9; ++i)
+                  matrixValues[i] = AJ[i*n+c];
+              M.add_local(cellMatrix, rows.size(), rows.data(), columns.size(), columns.data());
+            }
+          }
+          if( finalize_tensor )
+          {
+            b.apply("add");
+            M.apply("add");
+          }
+        }
+
+      private:
+        /// Cell-wise values of the coefficients f and x of Form_F, gathered block-wise in structure-of-arrays layout.
+        class Coefficients
+        {
+        public:
+          Coefficients(const dolfin::Function& f, const dolfin::Function& x, std::size_t blockSize)
+            : f_(f), x_(x),
+              fDofmap_(*f.function_space()->dofmap()),
+              xDofmap_(*x.function_space()->dofmap()),
+              fValues_(3*blockSize), xValues_(3*blockSize)
+          {}
+
+          /// Reads the values on the cells first, ..., first+n-1 with one get_local per coefficient.
+          void gather(std::size_t first, std::size_t n)
+          {
+            cellDofs(fDofmap_, first, n, fRows_);
+            gather(f_, fRows_, n, fValues_);
+            if( &xDofmap_ == &fDofmap_ )
+              return gather(x_, fRows_, n, xValues_);
+            cellDofs(xDofmap_, first, n, xRows_);
+            gather(x_, xRows_, n, xValues_);
+          }
+
+          const double* f() const
+          {
+            return fValues_.data();
+          }
+
+          const double* x() const
+          {
+            return xValues_.data();
+          }
+
+        private:
+          static void cellDofs(const dolfin::GenericDofMap& dofmap, std::size_t first, std::size_t n, std::vector<dolfin::la_index>& rows)
+          {
+            rows.resize(3*n);
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto dofs = dofmap.cell_dofs(first + c);
+              for(auto k=0u; k<3; ++k)
+                rows[3*c + k] = dofs[k];
+            }
+          }
+
+          void gather(const dolfin::Function& f, const std::vector<dolfin::la_index>& rows, std::size_t n, std::vector<double>& result)
+          {
+            values_.resize(3*n);
+            f.vector()->get_local(values_.data(), rows.size(), rows.data());
+            for(auto c=0u; c<n; ++c)
+              for(auto k=0u; k<3; ++k)
+                result[k*n + c] = values_[3*c + k];
+          }
+
+          const dolfin::Function& f_;
+          const dolfin::Function& x_;
+          const dolfin::GenericDofMap& fDofmap_;
+          const dolfin::GenericDofMap& xDofmap_;
+          std::vector<dolfin::la_index> fRows_, xRows_;
+          std::vector<double> values_, fValues_, xValues_;
+        };
+
+        /// Congruence classes of the cells of a mesh, with the element matrix of Form_J of each class.
+        class Congruence
+        {
+        public:
+          explicit Congruence(const dolfin::Mesh& mesh)
+            : classes_(mesh), tensors_(9*classes_.numberOfClasses())
+          {
+            const auto m = classes_.numberOfClasses();
+            std::vector<std::size_t> representatives(m);
+            for(auto k=0u; k<m; ++k)
+              representatives[k] = classes_.representative(k);
+            std::vector<double> coordinates, A(9*m);
+            FEniCS::Detail::fillCoordinates(mesh, 0, m, coordinates, representatives.data());
+            tabulateJ(A.data(), coordinates.data(), m);
+            for(auto k=0u; k<m; ++k)
+              for(auto i=0u; i<9; ++i)
+                tensors_[9*k + i] = A[i*m + k];
+          }
+
+          /// Element matrix of Form_J on cell, taken from the representative of its class.
+          const double* tensor(std::size_t cell) const
+          {
+            return &tensors_[9*classes_.classOf(cell)];
+          }
+
+        private:
+          CongruentCells classes_;
+          std::vector<double> tensors_;
+        };
+
+        void assembleCongruent(dolfin::GenericMatrix& M, const dolfin::Mesh& mesh, const dolfin::GenericDofMap& rowDofmap,
+                               const dolfin::GenericDofMap& columnDofmap)
+        {
+          const auto congruence = congruenceOf(mesh);
+          for(std::size_t cell=0; cell<mesh.num_cells(); ++cell)
+          {
+            const auto rows = rowDofmap.cell_dofs(cell);
+            const auto columns = columnDofmap.cell_dofs(cell);
+            M.add_local(congruence->tensor(cell), rows.size(), rows.data(), columns.size(), columns.data());
+          }
+          if( finalize_tensor )
+            M.apply("add");
+        }
+
+        /// Congruence classes for the geometry given on construction, computed once, or for this assembly only.
+        std::shared_ptr<const Congruence> congruenceOf(const dolfin::Mesh& mesh)
+        {
+          if( !geometry_ )
+            return std::make_shared<Congruence>(mesh);
+          geometryOf(mesh);
+          if( !congruence_ )
+            congruence_ = std::make_shared<Congruence>(mesh);
+          return congruence_;
+        }
+
+        /// Geometry given on construction, or the geometry of mesh computed for this assembly only.
+        std::shared_ptr<const AffineGeometry> geometryOf(const dolfin::Mesh& mesh) const
+        {
+          if( !geometry_ )
+            return std::make_shared<AffineGeometry>(mesh);
+          if( !geometry_->isGeometryOf(mesh) )
+            throw std::invalid_argument("LinearHeatKernels::Assembler: geometry does not belong to the mesh of the form.");
+          return geometry_;
+        }
+
+        static const dolfin::Mesh& checkMesh(const dolfin::Form& form)
+        {
+          const auto& mesh = *form.mesh();
+          if( mesh.topology().dim() != 2 || mesh.geometry().dim() != 2 )
+            throw std::invalid_argument("LinearHeatKernels::Assembler: batched kernels require a triangle mesh in 2D.");
+          return mesh;
+        }
+
+        static std::shared_ptr<const dolfin::Function> function(const dolfin::Form& form, std::size_t i)
+        {
+          const auto f = std::dynamic_pointer_cast<const dolfin::Function>(form.coefficient(i));
+          if( !f )
+            throw std::invalid_argument("LinearHeatKernels::Assembler: coefficients must be dolfin::Functions.");
+          return f;
+        }
+
+        std::size_t blockSize_;
+        bool reuseCongruentCells_;
+        std::shared_ptr<const AffineGeometry> geometry_;
+        std::shared_ptr<const Congruence> congruence_;
+      };
+    }
+  }
+}
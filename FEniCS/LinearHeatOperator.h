@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/mesh/Mesh.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include "LinearHeat.h"
+#include "LinearHeatKernels.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace LinearHeatKernels
+    {
+      /**
+       * @brief Matrix-free application of Form_J of LinearHeat.ufl, y = J v.
+       *
+       * The element matrices are computed block-wise by the batched kernels and applied cell by cell, such that no
+       * sparse matrix is stored. With cacheGeometry, the three geometry factors per cell (see tabulateJFactors)
+       * are computed once on construction and the coordinates are not read again; otherwise apply recomputes them
+       * from the mesh. Either way, the element matrices are bit-identical to the ones of the generated code.
+       *
+       * Vectors are indexed with the local dofs of the cells, i.e. in parallel v must carry the ghost values,
+       * as the vectors of dolfin::Functions do.
+       */
+      class JacobianOperator
+      {
+      public:
+        JacobianOperator(const LinearHeat::Form_J& J, const VectorSpace& domain, const VectorSpace& range,
+                         bool cacheGeometry = true, std::size_t blockSize = 256)
+          : mesh_(J.mesh()),
+            dofmap_(J.function_space(0)->dofmap()),
+            domain_(&domain),
+            range_(&range),
+            blockSize_(std::max<std::size_t>(blockSize, 1))
+        {
+          if( mesh_->topology().dim() != 2 || mesh_->geometry().dim() != 2 )
+            throw std::invalid_argument("LinearHeatKernels::JacobianOperator: batched kernels require a triangle mesh in 2D.");
+          if( !cacheGeometry )
+            return;
+
+          factors_.resize(3*mesh_->num_cells());
+          std::vector<double> coordinates;
+          for(std::size_t first=0; first<mesh_->num_cells(); first+=blockSize_)
+          {
+            const auto n = std::min(blockSize_, mesh_->num_cells() - first);
+            FEniCS::Detail::fillCoordinates(*mesh_, first, n, coordinates);
+            tabulateJFactors(&factors_[3*first], coordinates.data(), n);
+          }
+        }
+
+        /// y = J v, overwriting y.
+        void apply(const dolfin::GenericVector& v, dolfin::GenericVector& y) const
+        {
+          y.zero();
+          std::vector<double> coordinates, factors(3*blockSize_), A(9*blockSize_), values(3*blockSize_), result(3*blockSize_);
+          std::vector<dolfin::la_index> rows(3*blockSize_);
+          for(std::size_t first=0; first<mesh_->num_cells(); first+=blockSize_)
+          {
+            const auto n = std::min(blockSize_, mesh_->num_cells() - first);
+            if( factors_.empty() )
+            {
+              FEniCS::Detail::fillCoordinates(*mesh_, first, n, coordinates);
+              tabulateJFactors(factors.data(), coordinates.data(), n);
+              tabulateJFromFactors(A.data(), factors.data(), n);
+            }
+            else
+              tabulateJFromFactors(A.data(), &factors_[3*first], n);
+
+            for(auto c=0u; c<n; ++c)
+            {
+              const auto dofs = dofmap_->cell_dofs(first + c);
+              for(auto k=0u; k<3; ++k)
+                rows[3*c + k] = dofs[k];
+            }
+            v.get_local(values.data(), 3*n, rows.data());
+            for(auto c=0u; c<n; ++c)
+              for(auto i=0u; i<3; ++i)
+              {
+                auto sum = 0.;
+                for(auto j=0u; j<3; ++j)
+                  sum += A[(3*i + j)*n + c] * values[3*c + j];
+                result[3*c + i] = sum;
+              }
+            y.add_local(result.data(), 3*n, rows.data());
+          }
+          y.apply("add");
+        }
+
+        /// J x for a vector x of the domain, as a vector of the range.
+        ::Spacy::Vector operator()(const ::Spacy::Vector& x) const
+        {
+          auto y = zero(range());
+          apply(cast_ref<Vector>(x).get(), cast_ref<Vector>(y).get());
+          return y;
+        }
+
+        const VectorSpace& domain() const
+        {
+          return *domain_;
+        }
+
+        const VectorSpace& range() const
+        {
+          return *range_;
+        }
+
+        /// Memory held for repeated applications, in bytes.
+        std::size_t memoryUsage() const
+        {
+          return factors_.capacity()*sizeof(double);
+        }
+
+      private:
+        std::shared_ptr<const dolfin::Mesh> mesh_;
+        std::shared_ptr<const dolfin::GenericDofMap> dofmap_;
+        const VectorSpace* domain_;
+        const VectorSpace* range_;
+        std::size_t blockSize_;
+        std::vector<double> factors_;
+      };
+    }
+  }
+}
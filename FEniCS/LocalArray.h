@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+#include <petscvec.h>
+
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/la/PETScVector.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /// Process-local entries of a PETSc backed dolfin vector, acquired for the lifetime of this object.
+    class LocalArray
+    {
+    public:
+      explicit LocalArray(dolfin::GenericVector& v)
+        : vec_(dolfin::as_type<dolfin::PETScVector>(v).vec())
+      {
+        PetscInt size = 0;
+        VecGetLocalSize(vec_, &size);
+        size_ = size;
+        VecGetArray(vec_, &data_);
+      }
+
+      LocalArray(const LocalArray&) = delete;
+      LocalArray& operator=(const LocalArray&) = delete;
+
+      ~LocalArray()
+      {
+        VecRestoreArray(vec_, &data_);
+      }
+
+      double* data()
+      {
+        return data_;
+      }
+
+      double& operator[](std::size_t i)
+      {
+        return data_[i];
+      }
+
+      std::size_t size() const
+      {
+        return size_;
+      }
+
+    private:
+      Vec vec_;
+      double* data_ = nullptr;
+      std::size_t size_ = 0;
+    };
+
+    /// Read-only process-local entries of a PETSc backed dolfin vector.
+    class ConstLocalArray
+    {
+    public:
+      explicit ConstLocalArray(const dolfin::GenericVector& v)
+        : vec_(dolfin::as_type<const dolfin::PETScVector>(v).vec())
+      {
+        PetscInt size = 0;
+        VecGetLocalSize(vec_, &size);
+        size_ = size;
+        VecGetArrayRead(vec_, &data_);
+      }
+
+      ConstLocalArray(const ConstLocalArray&) = delete;
+      ConstLocalArray& operator=(const ConstLocalArray&) = delete;
+
+      ~ConstLocalArray()
+      {
+        VecRestoreArrayRead(vec_, &data_);
+      }
+
+      const double* data() const
+      {
+        return data_;
+      }
+
+      double operator[](std::size_t i) const
+      {
+        return data_[i];
+      }
+
+      std::size_t size() const
+      {
+        return size_;
+      }
+
+    private:
+      Vec vec_;
+      const double* data_ = nullptr;
+      std::size_t size_ = 0;
+    };
+
+    /// Overwrite all process-local entries of v with values[0], ..., values[size-1] in one pass.
+    inline void setLocal(dolfin::GenericVector& v, const double* values, std::size_t size)
+    {
+      LocalArray array(v);
+      if( size != array.size() )
+        throw std::invalid_argument("setLocal: number of values does not match local size of vector.");
+      std::copy(values, values + size, array.data());
+    }
+
+    inline void setLocal(dolfin::GenericVector& v, const std::vector<double>& values)
+    {
+      setLocal(v, values.data(), values.size());
+    }
+
+    inline void setLocal(Vector& v, const double* values, std::size_t size)
+    {
+      setLocal(v.get(), values, size);
+    }
+
+    inline void setLocal(Vector& v, const std::vector<double>& values)
+    {
+      setLocal(v.get(), values.data(), values.size());
+    }
+
+    /// Read all process-local entries of v into values[0], ..., values[size-1] in one pass.
+    inline void getLocal(const dolfin::GenericVector& v, double* values, std::size_t size)
+    {
+      ConstLocalArray array(v);
+      if( size != array.size() )
+        throw std::invalid_argument("getLocal: number of values does not match local size of vector.");
+      std::copy(array.data(), array.data() + size, values);
+    }
+
+    inline void getLocal(const Vector& v, double* values, std::size_t size)
+    {
+      getLocal(v.get(), values, size);
+    }
+  }
+}
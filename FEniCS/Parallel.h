@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <mpi.h>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+#include "LocalArray.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /// Default number of threads for component-parallel operations.
+    inline unsigned defaultNumberOfThreads()
+    {
+      return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    /// Number of vector entries below which component-parallel operations run serially, as thread hand-off costs more than the loop.
+    inline std::size_t minimumParallelWork()
+    {
+      return 1u << 15;
+    }
+
+    /// numberOfThreads if work, e.g. the number of vector entries to process, is large enough, and 1 otherwise.
+    inline unsigned numberOfThreadsFor(std::size_t work, unsigned numberOfThreads)
+    {
+      return work < minimumParallelWork() ? 1u : numberOfThreads;
+    }
+
+    /**
+     * @brief Persistent worker threads for parallelFor.
+     *
+     * The calling thread always takes part in its own loop, and workers only help. Loops therefore complete even if
+     * all workers are busy, e.g. for nested calls of parallelFor.
+     */
+    class ThreadPool
+    {
+      struct Job
+      {
+        Job(std::size_t n, const std::function<void(std::size_t)>& f)
+          : n(n), f(f)
+        {}
+
+        void work()
+        {
+          for(auto i = next++; i < n; i = next++)
+          {
+            if( !failed )
+              try
+              {
+                f(i);
+              }
+              catch(...)
+              {
+                std::lock_guard<std::mutex> lock(mutex);
+                if( !error )
+                  error = std::current_exception();
+                failed = true;
+              }
+            if( ++done == n )
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              finished.notify_all();
+            }
+          }
+        }
+
+        std::size_t n;
+        const std::function<void(std::size_t)>& f;
+        std::atomic<std::size_t> next{0};
+        std::atomic<std::size_t> done{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable finished;
+      };
+
+    public:
+      explicit ThreadPool(unsigned numberOfWorkers)
+      {
+        for(auto k=0u; k<numberOfWorkers; ++k)
+          workers_.emplace_back([this] { serve(); });
+      }
+
+      ThreadPool(const ThreadPool&) = delete;
+      ThreadPool& operator=(const ThreadPool&) = delete;
+
+      ~ThreadPool()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          stop_ = true;
+        }
+        wakeup_.notify_all();
+        for(auto& worker : workers_)
+          worker.join();
+      }
+
+      /// Pool with defaultNumberOfThreads()-1 workers, started on first use.
+      static ThreadPool& instance()
+      {
+        static ThreadPool pool(defaultNumberOfThreads() - 1);
+        return pool;
+      }
+
+      std::size_t numberOfWorkers() const
+      {
+        return workers_.size();
+      }
+
+      /// Calls f(0), ..., f(n-1) on the calling thread and up to numberOfHelpers workers. Rethrows the first exception of f.
+      void run(std::size_t n, std::size_t numberOfHelpers, const std::function<void(std::size_t)>& f)
+      {
+        auto job = std::make_shared<Job>(n, f);
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          for(auto k=0u; k<std::min(numberOfHelpers, workers_.size()); ++k)
+            jobs_.push_back(job);
+        }
+        wakeup_.notify_all();
+
+        job->work();
+        {
+          std::unique_lock<std::mutex> lock(job->mutex);
+          job->finished.wait(lock, [&job] { return job->done == job->n; });
+        }
+        if( job->error )
+          std::rethrow_exception(job->error);
+      }
+
+    private:
+      void serve()
+      {
+        while( true )
+        {
+          std::shared_ptr<Job> job;
+          {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wakeup_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if( stop_ )
+              return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+          }
+          // jobs that are complete already return immediately, without touching f
+          job->work();
+        }
+      }
+
+      std::vector<std::thread> workers_;
+      std::deque<std::shared_ptr<Job>> jobs_;
+      std::mutex mutex_;
+      std::condition_variable wakeup_;
+      bool stop_ = false;
+    };
+
+    /**
+     * @brief Calls f(0), ..., f(n-1) on up to numberOfThreads threads of ThreadPool::instance().
+     *
+     * Threads take the next index from a shared counter, so unevenly sized tasks are balanced dynamically.
+     * If f throws, the remaining indices are skipped and the first exception is rethrown on the calling thread.
+     */
+    template <class F>
+    void parallelFor(std::size_t n, unsigned numberOfThreads, const F& f)
+    {
+      const auto numberOfWorkers = std::min<std::size_t>(numberOfThreads, n);
+      if( numberOfWorkers <= 1 )
+      {
+        for(auto i=0u; i<n; ++i)
+          f(i);
+        return;
+      }
+      ThreadPool::instance().run(n, numberOfWorkers - 1, std::function<void(std::size_t)>(std::cref(f)));
+    }
+
+    namespace Detail
+    {
+      /// FEniCS vectors that make up x, in the component order of (nested) product space vectors.
+      template <class SpacyVector, class FEniCSVector>
+      void collectLeaves(SpacyVector& x, std::vector<FEniCSVector*>& leaves)
+      {
+        if( is<ProductSpace::Vector>(x) )
+        {
+          auto& x_ = cast_ref<ProductSpace::Vector>(x);
+          for(auto k=0u; k<x_.numberOfVariables(); ++k)
+            collectLeaves(x_.component(k), leaves);
+          return;
+        }
+        leaves.push_back(&cast_ref<Vector>(x));
+      }
+
+      /// Process-local arrays of the leaves of x, acquired on the calling thread.
+      inline std::vector<std::unique_ptr<LocalArray>> localArrays(::Spacy::Vector& x)
+      {
+        std::vector<Vector*> leaves;
+        collectLeaves(x, leaves);
+        std::vector<std::unique_ptr<LocalArray>> arrays;
+        for(auto* leaf : leaves)
+          arrays.push_back(std::make_unique<LocalArray>(leaf->get()));
+        return arrays;
+      }
+
+      inline std::vector<std::unique_ptr<ConstLocalArray>> localArrays(const ::Spacy::Vector& x)
+      {
+        std::vector<const Vector*> leaves;
+        collectLeaves(x, leaves);
+        std::vector<std::unique_ptr<ConstLocalArray>> arrays;
+        for(const auto* leaf : leaves)
+          arrays.push_back(std::make_unique<ConstLocalArray>(leaf->get()));
+        return arrays;
+      }
+
+      /// Number of entries of all arrays together.
+      template <class Arrays>
+      std::size_t totalSize(const Arrays& arrays)
+      {
+        std::size_t size = 0;
+        for(const auto& array : arrays)
+          size += array->size();
+        return size;
+      }
+
+      template <class Arrays, class OtherArrays>
+      void checkLeaves(const Arrays& x, const OtherArrays& y)
+      {
+        if( x.size() != y.size() )
+          throw std::invalid_argument("Component-parallel operation: vectors have different numbers of components.");
+        for(auto k=0u; k<x.size(); ++k)
+          if( x[k]->size() != y[k]->size() )
+            throw std::invalid_argument("Component-parallel operation: local sizes of components do not match.");
+      }
+    }
+
+    /// x += a*y, with one task per FEniCS component of x. Runs serially below minimumParallelWork() entries.
+    inline void axpy(::Spacy::Vector& x, double a, const ::Spacy::Vector& y, unsigned numberOfThreads = defaultNumberOfThreads())
+    {
+      auto x_ = Detail::localArrays(x);
+      const auto y_ = Detail::localArrays(y);
+      Detail::checkLeaves(x_, y_);
+      parallelFor(x_.size(), numberOfThreadsFor(Detail::totalSize(x_), numberOfThreads), [&](std::size_t k)
+      {
+        auto* xData = x_[k]->data();
+        const auto* yData = y_[k]->data();
+        for(auto i=0u; i<x_[k]->size(); ++i)
+          xData[i] += a*yData[i];
+      });
+    }
+
+    /// x += y, with one task per FEniCS component of x.
+    inline void add(::Spacy::Vector& x, const ::Spacy::Vector& y, unsigned numberOfThreads = defaultNumberOfThreads())
+    {
+      axpy(x, 1., y, numberOfThreads);
+    }
+
+    /// x -= y, with one task per FEniCS component of x.
+    inline void subtract(::Spacy::Vector& x, const ::Spacy::Vector& y, unsigned numberOfThreads = defaultNumberOfThreads())
+    {
+      axpy(x, -1., y, numberOfThreads);
+    }
+
+    /// x *= a, with one task per FEniCS component of x.
+    inline void scale(::Spacy::Vector& x, double a, unsigned numberOfThreads = defaultNumberOfThreads())
+    {
+      auto x_ = Detail::localArrays(x);
+      parallelFor(x_.size(), numberOfThreadsFor(Detail::totalSize(x_), numberOfThreads), [&](std::size_t k)
+      {
+        auto* xData = x_[k]->data();
+        for(auto i=0u; i<x_[k]->size(); ++i)
+          xData[i] *= a;
+      });
+    }
+
+    /**
+     * @brief x(y), with one task per FEniCS component.
+     *
+     * The partial results of the components are summed in component order, followed by one MPI reduction,
+     * such that the result does not depend on the number of threads.
+     */
+    inline double dualPairing(const ::Spacy::Vector& x, const ::Spacy::Vector& y, unsigned numberOfThreads = defaultNumberOfThreads())
+    {
+      std::vector<const Vector*> leaves;
+      Detail::collectLeaves(x, leaves);
+      const auto x_ = Detail::localArrays(x);
+      const auto y_ = Detail::localArrays(y);
+      Detail::checkLeaves(x_, y_);
+
+      std::vector<double> partial(x_.size(), 0.);
+      parallelFor(x_.size(), numberOfThreadsFor(Detail::totalSize(x_), numberOfThreads), [&](std::size_t k)
+      {
+        const auto* xData = x_[k]->data();
+        const auto* yData = y_[k]->data();
+        auto result = 0.;
+        for(auto i=0u; i<x_[k]->size(); ++i)
+          result += xData[i]*yData[i];
+        partial[k] = result;
+      });
+
+      auto result = 0.;
+      for(auto value : partial)
+        result += value;
+      if( !leaves.empty() )
+        MPI_Allreduce(MPI_IN_PLACE, &result, 1, MPI_DOUBLE, MPI_SUM, leaves.front()->get().mpi_comm());
+      return result;
+    }
+  }
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+
+#include <dolfin/fem/Assembler.h>
+#include <dolfin/fem/Form.h>
+#include <dolfin/la/PETScMatrix.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Matrices with preallocated sparsity pattern, one per bilinear form and pair of function spaces.
+     *
+     * Forms are identified by the signature of their ufc::form and the ids of their test and trial spaces, such that
+     * e.g. a new LinearHeat::Form_J in each time step on the same space maps to the same matrix. The sparsity pattern is
+     * computed by the first assembly, as dolfin initializes empty tensors only; later assemblies only zero and fill
+     * the values. Consequently, the matrix returned for a form is overwritten by the next assembly of the same key.
+     *
+     * The matrices are owned by this object, which should therefore be destroyed before PETSc is finalized.
+     */
+    class PreallocatedMatrices
+    {
+    public:
+      /// Matrix for form, empty until the first assembly.
+      std::shared_ptr<dolfin::PETScMatrix> matrix(const dolfin::Form& form)
+      {
+        if( form.rank() != 2 )
+          throw std::invalid_argument("PreallocatedMatrices: form must be bilinear.");
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& matrix = matrices_[Key(form.ufc_form()->signature(), form.function_space(0)->id(), form.function_space(1)->id())];
+        if( !matrix )
+          matrix = std::make_shared<dolfin::PETScMatrix>();
+        return matrix;
+      }
+
+      /// Assembles form into its matrix with assembler, e.g. dolfin::Assembler or LinearHeatKernels::Assembler.
+      template <class Assembler, class Form>
+      std::shared_ptr<dolfin::PETScMatrix> assemble(const Form& form, Assembler& assembler)
+      {
+        const auto A = matrix(form);
+        // restores add_values also if the assembly throws
+        struct AddValuesGuard
+        {
+          ~AddValuesGuard() { assembler.add_values = addValues; }
+          Assembler& assembler;
+          bool addValues;
+        } guard{assembler, assembler.add_values};
+        assembler.add_values = false;
+        assembler.assemble(*A, form);
+        return A;
+      }
+
+      std::shared_ptr<dolfin::PETScMatrix> assemble(const dolfin::Form& form)
+      {
+        dolfin::Assembler assembler;
+        return assemble(form, assembler);
+      }
+
+      /// Number of cached matrices, i.e. of sparsity patterns.
+      std::size_t size() const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return matrices_.size();
+      }
+
+      /// Drops all matrices, e.g. after the mesh has been refined in place.
+      void clear()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        matrices_.clear();
+      }
+
+    private:
+      using Key = std::tuple<std::string, std::size_t, std::size_t>;
+
+      mutable std::mutex mutex_;
+      std::map<Key, std::shared_ptr<dolfin::PETScMatrix>> matrices_;
+    };
+  }
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+#include <dolfin/function/FunctionSpace.h>
+#include <dolfin/la/GenericVector.h>
+#include <dolfin/mesh/Mesh.h>
+
+#include "GeometryCache.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /**
+     * @brief Form_F of L2Functional.ufl, y*y*dx + u*u*dx + p*p*dx, evaluated as the quadratic form x^T M x.
+     *
+     * M is the block-diagonal P1 mass matrix of the mixed space, assembled once on construction from the affine
+     * geometry and stored in compressed row format over the dofs of the process-local cells.
+     * The functional, its gradient 2 M x and Hessian-vector products 2 M v then reduce to one gather, one sparse
+     * matrix-vector product and a dot product or scatter. The quadrature of the generated code is exact for P1,
+     * so results agree with assembling Form_F up to rounding.
+     *
+     * Instances are owned by the caller. Evaluations only read the matrix and write to a caller-supplied Workspace
+     * from workspace(), which is reused across evaluations to avoid allocations. Several threads may evaluate the same
+     * instance concurrently, each with its own workspace. Vectors are indexed with the local dofs of the cells, i.e. in parallel they must carry the ghost values.
+     */
+    class QuadraticL2Functional
+    {
+    public:
+      /// Gathered values of x and M x over the dofs of the local cells.
+      struct Workspace
+      {
+        std::vector<double> values, Mx;
+      };
+
+      explicit QuadraticL2Functional(const dolfin::FunctionSpace& V)
+      {
+        const auto& mesh = *V.mesh();
+        const auto& dofmap = *V.dofmap();
+        const AffineGeometry geometry(mesh);
+
+        // compress rows and columns to the dofs that occur in the local cells
+        for(std::size_t cell=0; cell<mesh.num_cells(); ++cell)
+        {
+          const auto dofs = dofmap.cell_dofs(cell);
+          if( dofs.size() != 9 )
+            throw std::invalid_argument("QuadraticL2Functional: requires the mixed P1 space of L2Functional.ufl.");
+          dofs_.insert(dofs_.end(), dofs.data(), dofs.data() + dofs.size());
+        }
+        std::sort(dofs_.begin(), dofs_.end());
+        dofs_.erase(std::unique(dofs_.begin(), dofs_.end()), dofs_.end());
+        const auto n = dofs_.size();
+        std::vector<std::size_t> position(n > 0 ? dofs_.back() + 1 : 0);
+        for(auto i=0u; i<n; ++i)
+          position[dofs_[i]] = i;
+
+        // count three entries per row and cell, fill them, then merge the duplicates within each row
+        rowOffsets_.assign(n + 1, 0);
+        for(std::size_t cell=0; cell<mesh.num_cells(); ++cell)
+        {
+          const auto dofs = dofmap.cell_dofs(cell);
+          for(auto a=0u; a<9; ++a)
+            rowOffsets_[position[dofs[a]] + 1] += 3;
+        }
+        for(auto i=0u; i<n; ++i)
+          rowOffsets_[i+1] += rowOffsets_[i];
+
+        columns_.resize(rowOffsets_[n]);
+        values_.resize(rowOffsets_[n]);
+        std::vector<std::size_t> next(rowOffsets_.begin(), rowOffsets_.end() - 1);
+        for(std::size_t cell=0; cell<mesh.num_cells(); ++cell)
+        {
+          const auto dofs = dofmap.cell_dofs(cell);
+          const auto volume = std::abs(geometry.detJ(cell))/24;
+          for(auto k=0u; k<3; ++k)
+            for(auto a=0u; a<3; ++a)
+            {
+              auto& entry = next[position[dofs[3*k + a]]];
+              for(auto b=0u; b<3; ++b, ++entry)
+              {
+                columns_[entry] = position[dofs[3*k + b]];
+                values_[entry] = (a == b ? 2 : 1)*volume;
+              }
+            }
+        }
+
+        std::vector<std::pair<std::size_t, double>> row;
+        std::size_t size = 0;
+        for(auto i=0u; i<n; ++i)
+        {
+          row.clear();
+          for(auto k=rowOffsets_[i]; k<rowOffsets_[i+1]; ++k)
+            row.emplace_back(columns_[k], values_[k]);
+          std::sort(row.begin(), row.end());
+
+          rowOffsets_[i] = size;
+          for(const auto& entry : row)
+          {
+            if( size > rowOffsets_[i] && columns_[size-1] == entry.first )
+            {
+              values_[size-1] += entry.second;
+              continue;
+            }
+            columns_[size] = entry.first;
+            values_[size++] = entry.second;
+          }
+        }
+        rowOffsets_[n] = size;
+        columns_.resize(size);
+        columns_.shrink_to_fit();
+        values_.resize(size);
+        values_.shrink_to_fit();
+      }
+
+      /// Workspace for the evaluations of this instance.
+      Workspace workspace() const
+      {
+        return {std::vector<double>(dofs_.size()), std::vector<double>(dofs_.size())};
+      }
+
+      /// x^T M x.
+      double operator()(const dolfin::GenericVector& x, Workspace& workspace) const
+      {
+        multiply(x, workspace);
+        auto result = 0.;
+        for(auto i=0u; i<dofs_.size(); ++i)
+          result += workspace.values[i]*workspace.Mx[i];
+        MPI_Allreduce(MPI_IN_PLACE, &result, 1, MPI_DOUBLE, MPI_SUM, x.mpi_comm());
+        return result;
+      }
+
+      /// g = 2 M x, overwriting g.
+      void gradient(const dolfin::GenericVector& x, dolfin::GenericVector& g, Workspace& workspace) const
+      {
+        applyTwice(x, g, workspace);
+      }
+
+      /// y = 2 M v, overwriting y.
+      void hessian(const dolfin::GenericVector& v, dolfin::GenericVector& y, Workspace& workspace) const
+      {
+        applyTwice(v, y, workspace);
+      }
+
+      /// Number of stored entries of M.
+      std::size_t numberOfNonZeros() const
+      {
+        return values_.size();
+      }
+
+      std::size_t memoryUsage() const
+      {
+        return values_.capacity()*sizeof(double) + columns_.capacity()*sizeof(std::size_t)
+            + rowOffsets_.capacity()*sizeof(std::size_t) + dofs_.capacity()*sizeof(dolfin::la_index);
+      }
+
+    private:
+      /// Gathers x into workspace.values and writes M x to workspace.Mx.
+      void multiply(const dolfin::GenericVector& x, Workspace& workspace) const
+      {
+        const auto n = dofs_.size();
+        if( workspace.values.size() != n || workspace.Mx.size() != n )
+          throw std::invalid_argument("QuadraticL2Functional: workspace does not belong to this functional.");
+        auto* values = workspace.values.data();
+        x.get_local(values, n, dofs_.data());
+        for(auto i=0u; i<n; ++i)
+        {
+          auto sum = 0.;
+          for(auto k=rowOffsets_[i]; k<rowOffsets_[i+1]; ++k)
+            sum += values_[k]*values[columns_[k]];
+          workspace.Mx[i] = sum;
+        }
+      }
+
+      /// y = 2 M x, overwriting y.
+      void applyTwice(const dolfin::GenericVector& x, dolfin::GenericVector& y, Workspace& workspace) const
+      {
+        multiply(x, workspace);
+        for(auto& value : workspace.Mx)
+          value *= 2;
+        y.zero();
+        y.add_local(workspace.Mx.data(), dofs_.size(), dofs_.data());
+        y.apply("add");
+      }
+
+      std::vector<dolfin::la_index> dofs_;
+      std::vector<std::size_t> rowOffsets_;
+      std::vector<std::size_t> columns_;
+      std::vector<double> values_;
+    };
+  }
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <queue>
+#include <vector>
+
+#include <dolfin/fem/GenericDofMap.h>
+#include <dolfin/function/FunctionSpace.h>
+#include <dolfin/mesh/Mesh.h>
+
+#include "Dofmap.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// Adjacency lists of the process-local dofs of V, two dofs being adjacent if they share a cell.
+      inline std::vector<std::vector<std::size_t>> dofGraph(const dolfin::FunctionSpace& V)
+      {
+        const auto range = V.dofmap()->ownership_range();
+        const auto n = std::size_t(range.second - range.first);
+        std::vector<std::vector<std::size_t>> graph(n);
+
+        const auto& mesh = *V.mesh();
+        for(auto c=0u; c<mesh.num_cells(); ++c)
+        {
+          const auto dofs = V.dofmap()->cell_dofs(c);
+          for(auto k=0; k<dofs.size(); ++k)
+            for(auto l=0; l<dofs.size(); ++l)
+              if( k != l && std::size_t(dofs[k]) < n && std::size_t(dofs[l]) < n )
+                graph[dofs[k]].push_back(dofs[l]);
+        }
+
+        for(auto& neighbours : graph)
+        {
+          std::sort(begin(neighbours), end(neighbours));
+          neighbours.erase(std::unique(begin(neighbours), end(neighbours)), end(neighbours));
+        }
+        return graph;
+      }
+    }
+
+    /**
+     * @brief Reverse Cuthill-McKee ordering of the nodes of a graph, given by its adjacency lists.
+     *
+     * Returns the permutation ordering with ordering[new] = old. Adjacent nodes get close numbers, which reduces the
+     * bandwidth of the associated sparse matrices and improves locality of loops over the nodes.
+     */
+    inline std::vector<std::size_t> reverseCuthillMcKee(const std::vector<std::vector<std::size_t>>& graph)
+    {
+      const auto n = graph.size();
+      const auto byDegree = [&graph](std::size_t a, std::size_t b) { return graph[a].size() < graph[b].size(); };
+
+      std::vector<std::size_t> nodes(n);
+      std::iota(begin(nodes), end(nodes), std::size_t(0));
+      std::stable_sort(begin(nodes), end(nodes), byDegree);
+
+      std::vector<std::size_t> ordering;
+      ordering.reserve(n);
+      std::vector<bool> visited(n, false);
+      std::vector<std::size_t> neighbours;
+      for(auto start : nodes)
+      {
+        if( visited[start] )
+          continue;
+
+        std::queue<std::size_t> queue;
+        queue.push(start);
+        visited[start] = true;
+        while( !queue.empty() )
+        {
+          const auto node = queue.front();
+          queue.pop();
+          ordering.push_back(node);
+
+          neighbours.clear();
+          for(auto neighbour : graph[node])
+            if( !visited[neighbour] )
+            {
+              visited[neighbour] = true;
+              neighbours.push_back(neighbour);
+            }
+          std::stable_sort(begin(neighbours), end(neighbours), byDegree);
+          for(auto neighbour : neighbours)
+            queue.push(neighbour);
+        }
+      }
+
+      std::reverse(begin(ordering), end(ordering));
+      return ordering;
+    }
+
+    /// Reverse Cuthill-McKee ordering of the process-local dofs of V, two dofs being adjacent if they share a cell.
+    inline std::vector<std::size_t> reverseCuthillMcKee(const dolfin::FunctionSpace& V)
+    {
+      return reverseCuthillMcKee(Detail::dofGraph(V));
+    }
+
+    /// Ordering of the dofs of a sub-space with dofmap that follows the ordering of its mixed space.
+    inline std::vector<std::size_t> restrictOrdering(const std::vector<std::size_t>& mixedOrdering, const Dofmap& dofmap)
+    {
+      std::vector<std::size_t> position(mixedOrdering.size());
+      for(auto k=0u; k<mixedOrdering.size(); ++k)
+        position[mixedOrdering[k]] = k;
+
+      std::vector<std::size_t> ordering(dofmap.size());
+      std::iota(begin(ordering), end(ordering), std::size_t(0));
+      std::sort(begin(ordering), end(ordering),
+                [&](std::size_t i, std::size_t j) { return position[dofmap.dofmap(i)] < position[dofmap.dofmap(j)]; });
+      return ordering;
+    }
+
+    /**
+     * @brief Dofmap of the renumbered sub-space, whose i-th dof is the dof ordering[i] of the original numbering.
+     *
+     * The result expects component values in the renumbered order, whereas FEniCS::Vector and CopyPlan, which always
+     * builds its dofmaps from the VectorCreators, keep the original order. Values must therefore be converted with
+     * permute() before scatter() and with inversePermute() after gather(); mixing both numberings scrambles values.
+     */
+    inline Dofmap renumber(const Dofmap& dofmap, const std::vector<std::size_t>& ordering)
+    {
+      std::vector<std::size_t> table(ordering.size());
+      dofmap.dofmap(ordering.data(), table.data(), ordering.size());
+      return Dofmap(table);
+    }
+
+    /// to[i] = from[ordering[i]], i.e. values in the original numbering to the renumbered one.
+    inline void permute(const std::vector<std::size_t>& ordering, const double* from, double* to)
+    {
+      for(auto i=0u; i<ordering.size(); ++i)
+        to[i] = from[ordering[i]];
+    }
+
+    /// to[ordering[i]] = from[i], i.e. values in the renumbered numbering to the original one.
+    inline void inversePermute(const std::vector<std::size_t>& ordering, const double* from, double* to)
+    {
+      for(auto i=0u; i<ordering.size(); ++i)
+        to[ordering[i]] = from[i];
+    }
+  }
+}
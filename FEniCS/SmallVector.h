@@ -0,0 +1,154 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+#include <dolfin/fem/GenericDofMap.h>
+#include <dolfin/function/FunctionSpace.h>
+
+#include "LocalArray.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// Number of dofs of V owned by this process, i.e. the local size of its vectors.
+      inline std::size_t localSize(const VectorSpace& V)
+      {
+        const auto range = creator<VectorCreator>(V).get()->dofmap()->ownership_range();
+        return range.second - range.first;
+      }
+    }
+
+    /**
+     * @brief Process-local vector with inline storage for at most N entries.
+     *
+     * For tiny spaces, creating PETSc vectors and reducing over MPI dominates the cost of vector arithmetic.
+     * SmallVector takes the local entries of a FEniCS::Vector once, runs arithmetic and dual pairings without
+     * heap allocations or communication, and writes the result back with copyTo.
+     * Dual pairings are process-local, i.e. only meaningful for serial runs. Sizes are always local sizes.
+     */
+    template <std::size_t N = 16>
+    class SmallVector
+    {
+    public:
+      explicit SmallVector(std::size_t size = 0)
+        : size_(size)
+      {
+        if( size > N )
+          throw std::length_error("SmallVector: size exceeds capacity.");
+        values_.fill(0.);
+      }
+
+      /// Zero vector of the local size of V, without creating a PETSc vector.
+      explicit SmallVector(const VectorSpace& V)
+        : SmallVector(Detail::localSize(V))
+      {}
+
+      explicit SmallVector(const Vector& v)
+        : SmallVector(v.get().local_size())
+      {
+        getLocal(v, data(), size_);
+      }
+
+      /// Overwrite the local entries of v.
+      void copyTo(Vector& v) const
+      {
+        setLocal(v, data(), size_);
+      }
+
+      SmallVector& operator+=(const SmallVector& y)
+      {
+        checkSize(y);
+        for(auto i=0u; i<size_; ++i)
+          values_[i] += y.values_[i];
+        return *this;
+      }
+
+      SmallVector& operator-=(const SmallVector& y)
+      {
+        checkSize(y);
+        for(auto i=0u; i<size_; ++i)
+          values_[i] -= y.values_[i];
+        return *this;
+      }
+
+      SmallVector& operator*=(double a)
+      {
+        for(auto i=0u; i<size_; ++i)
+          values_[i] *= a;
+        return *this;
+      }
+
+      SmallVector operator-() const
+      {
+        auto y = *this;
+        return y *= -1;
+      }
+
+      /// Dual pairing of the local entries.
+      double operator()(const SmallVector& y) const
+      {
+        checkSize(y);
+        auto result = 0.;
+        for(auto i=0u; i<size_; ++i)
+          result += values_[i]*y.values_[i];
+        return result;
+      }
+
+      double& operator[](std::size_t i)
+      {
+        return values_[i];
+      }
+
+      double operator[](std::size_t i) const
+      {
+        return values_[i];
+      }
+
+      double* data()
+      {
+        return values_.data();
+      }
+
+      const double* data() const
+      {
+        return values_.data();
+      }
+
+      std::size_t size() const
+      {
+        return size_;
+      }
+
+      static constexpr std::size_t capacity()
+      {
+        return N;
+      }
+
+    private:
+      void checkSize(const SmallVector& y) const
+      {
+        if( y.size_ != size_ )
+          throw std::invalid_argument("SmallVector: sizes do not match.");
+      }
+
+      std::array<double, N> values_;
+      std::size_t size_;
+    };
+
+    /// Checks if the local entries of vectors of V fit into SmallVector<N>.
+    template <std::size_t N = 16>
+    bool fitsSmallVector(const VectorSpace& V)
+    {
+      return Detail::localSize(V) <= N;
+    }
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/VectorSpace.h>
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    /// Leaf of a (possibly nested) product space created by makeHilbertSpace(space, primalIds, dualIds).
+    struct SubSpace
+    {
+      /// Number of the sub-space in the mixed dolfin::FunctionSpace.
+      unsigned id;
+      /// Component indices leading from the product space vector to this leaf.
+      std::vector<unsigned> path;
+      const VectorSpace* space;
+    };
+
+    namespace Detail
+    {
+      inline void collectSubSpaces(const VectorSpace& V, unsigned id, std::vector<unsigned>& path, std::vector<SubSpace>& subSpaces)
+      {
+        if( !is<ProductSpace::VectorCreator>(V.creator()) )
+        {
+          subSpaces.push_back({id, path, &V});
+          return;
+        }
+
+        const auto& X = creator<ProductSpace::VectorCreator>(V);
+        for(auto k=0u; k<X.numberOfSubSpaces(); ++k)
+        {
+          path.push_back(k);
+          collectSubSpaces(X.subSpace(k), X.inverseIdMap(k), path, subSpaces);
+          path.pop_back();
+        }
+      }
+    }
+
+    /// Leaves of V, ordered by their sub-space number in the underlying mixed space.
+    inline std::vector<SubSpace> subSpaces(const VectorSpace& V)
+    {
+      std::vector<SubSpace> result;
+      std::vector<unsigned> path;
+      Detail::collectSubSpaces(V, 0, path, result);
+      std::sort(begin(result), end(result), [](const SubSpace& a, const SubSpace& b) { return a.id < b.id; });
+      return result;
+    }
+
+    /// Leaf of x reached by following path through nested ProductSpace::Vector components.
+    inline ::Spacy::Vector& component(::Spacy::Vector& x, const std::vector<unsigned>& path)
+    {
+      auto* y = &x;
+      for(auto k : path)
+        y = &cast_ref<ProductSpace::Vector>(*y).component(k);
+      return *y;
+    }
+
+    inline const ::Spacy::Vector& component(const ::Spacy::Vector& x, const std::vector<unsigned>& path)
+    {
+      const auto* y = &x;
+      for(auto k : path)
+        y = &cast_ref<ProductSpace::Vector>(*y).component(k);
+      return *y;
+    }
+  }
+}
@@ -6,7 +6,21 @@
 #include <Spacy/Adapter/FEniCS/Vector.h>
 #include <Spacy/Adapter/FEniCS/VectorSpace.h>
 
+#include "Comparison.h"
+#include "DualPairings.h"
+#include "L2Functional.h"
+#include "LinearCombination.h"
 #include "LinearHeat.h"
+#include "LocalArray.h"
+#include "Parallel.h"
+#include "SmallVector.h"
+#include "VectorPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
 
 using namespace Spacy;
 
@@ -25,6 +39,10 @@ namespace
     const auto mesh = std::make_shared<dolfin::UnitIntervalMesh>(MPI_COMM_WORLD, degrees_of_freedom-1);
     const auto dolfin_V = std::make_shared<LinearHeat::FunctionSpace>(mesh);
     auto V = Spacy::FEniCS::makeHilbertSpace(dolfin_V);
+
+    const auto mesh2D = std::make_shared<dolfin::UnitSquareMesh>(1, 1);
+    const auto dolfin_V2D = std::make_shared<L2Functional::CoefficientSpace_x>(mesh2D);
+    const auto V2D = Spacy::FEniCS::makeHilbertSpace(dolfin_V2D, {0,1,2}, {});
 }
 
 TEST(FEniCSVectorAdapter,CreateFromFEniCSFunction)
@@ -115,6 +133,24 @@ TEST(FEniCSVectorAdapter,ApplyAsDual)
     EXPECT_EQ(get(dp), 4.);
 }
 
+TEST(FEniCSVectorAdapter,BatchedDualPairings)
+{
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    ::Spacy::Vector w = Spacy::FEniCS::Vector(v,V);
+    std::vector<::Spacy::Vector> ws(3, w);
+    ws[1] *= 2;
+    ws[2] *= -3;
+
+    const auto pairings = FEniCS::dualPairings(w, ws);
+
+    ASSERT_EQ( pairings.size(), ws.size() );
+    for(auto k=0u; k<ws.size(); ++k)
+        EXPECT_EQ( pairings[k], get(w(ws[k])) );
+    EXPECT_EQ( pairings[1], 2. );
+    EXPECT_TRUE( FEniCS::dualPairings(w, {}).empty() );
+}
+
 TEST(FEniCSVectorAdapter,Negation)
 {
     auto v = get_test_vector(V, degrees_of_freedom);
@@ -144,3 +180,350 @@ TEST(FEniCSVectorAdapter,Comparison)
     w0.get().setitem(1, 1 - 1.1*eps);
     EXPECT_FALSE( w0 == w1 );
 }
+
+TEST(FEniCSVectorAdapter,AllocationFreeComparison)
+{
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    Spacy::FEniCS::Vector w0(v,V);
+    Spacy::FEniCS::Vector w1(v,V);
+
+    EXPECT_TRUE( FEniCS::equal(w0, w1) );
+
+    const auto eps = 1e-5;
+    V.setEps(eps);
+
+    w0.get().setitem(1, 1 - 0.5*eps);
+    EXPECT_TRUE( FEniCS::equal(w0, w1) );
+    EXPECT_EQ( FEniCS::equal(w0, w1), w0 == w1 );
+
+    w0.get().setitem(1, 1 - 1.1*eps);
+    EXPECT_FALSE( FEniCS::equal(w0, w1) );
+    EXPECT_EQ( FEniCS::equal(w0, w1), w0 == w1 );
+}
+
+TEST(FEniCSVectorAdapter,AllocationFreeComparison_ZeroVectors)
+{
+    Spacy::FEniCS::Vector w0(V);
+    Spacy::FEniCS::Vector w1(V);
+
+    EXPECT_TRUE( FEniCS::equal(w0, w1) );
+}
+
+TEST(FEniCSVectorAdapter,SetLocal)
+{
+    Spacy::FEniCS::Vector w(V);
+
+    FEniCS::setLocal(w, std::vector<double>{3., 4.});
+
+    EXPECT_EQ( w.get()[0] , 3.);
+    EXPECT_EQ( w.get()[1] , 4.);
+}
+
+TEST(FEniCSVectorAdapter,GetLocal)
+{
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    Spacy::FEniCS::Vector w(v,V);
+    std::vector<double> values(degrees_of_freedom);
+    FEniCS::getLocal(w, values.data(), values.size());
+
+    EXPECT_EQ( values[0] , 0.);
+    EXPECT_EQ( values[1] , 1.);
+}
+
+TEST(FEniCSVectorAdapter,SetLocalCoincidesWithSetitem)
+{
+    Spacy::FEniCS::Vector w0(get_test_vector(V, degrees_of_freedom), V);
+    Spacy::FEniCS::Vector w1(V);
+
+    std::vector<double> values(degrees_of_freedom);
+    std::iota(begin(values), end(values), 0.);
+    FEniCS::setLocal(w1, values);
+
+    EXPECT_EQ( w0, w1 );
+}
+
+TEST(FEniCSVectorAdapter,SetLocalRejectsWrongSize)
+{
+    Spacy::FEniCS::Vector w(V);
+
+    EXPECT_THROW( FEniCS::setLocal(w, std::vector<double>(degrees_of_freedom+1)), std::invalid_argument );
+}
+
+TEST(FEniCSVectorAdapter,FusedLinearCombination)
+{
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    ::Spacy::Vector x = Spacy::FEniCS::Vector(v,V);
+    ::Spacy::Vector dx = x;
+    dx *= 2;
+    ::Spacy::Vector g = x;
+    g *= 3;
+    ::Spacy::Vector y = zero(V);
+
+    FEniCS::assign(y, FEniCS::term(x) + 0.5*FEniCS::term(dx) - 2*FEniCS::term(g));
+
+    EXPECT_EQ( cast_ref<FEniCS::Vector>(y).get()[0] , 0.);
+    EXPECT_EQ( cast_ref<FEniCS::Vector>(y).get()[1] , -4.);
+}
+
+TEST(FEniCSVectorAdapter,FusedLinearCombination_Aliasing)
+{
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    ::Spacy::Vector x = Spacy::FEniCS::Vector(v,V);
+    ::Spacy::Vector dx = x;
+    dx *= 2;
+
+    FEniCS::assign(x, -FEniCS::term(x) + FEniCS::term(dx) - FEniCS::term(x));
+
+    EXPECT_EQ( cast_ref<FEniCS::Vector>(x).get()[0] , 0.);
+    EXPECT_EQ( cast_ref<FEniCS::Vector>(x).get()[1] , 0.);
+}
+
+TEST(FEniCSVectorAdapter,FusedLinearCombination_ProductSpace)
+{
+    auto x = zero(V2D);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    for(auto j=0u; j<x_.numberOfVariables(); ++j)
+    {
+        auto& component = cast_ref<FEniCS::Vector>(x_.component(j));
+        std::vector<double> values(component.get().local_size());
+        std::iota(begin(values), end(values), 10.*j);
+        FEniCS::setLocal(component, values);
+    }
+    auto dx = x;
+    dx *= 2;
+    auto y = zero(V2D);
+
+    FEniCS::assign(y, 3*FEniCS::term(x) - FEniCS::term(dx));
+
+    EXPECT_EQ( y, x );
+}
+
+TEST(FEniCSVectorAdapter,AllocationFreeComparison_ProductSpace)
+{
+    auto x = zero(V2D);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(x_.component(1)), std::vector<double>{1., 2., 3., 4.});
+    auto y = x;
+
+    EXPECT_TRUE( FEniCS::equal(x, y) );
+
+    cast_ref<FEniCS::Vector>(cast_ref<ProductSpace::Vector>(y).component(1)).get().setitem(2, 4.);
+    EXPECT_FALSE( FEniCS::equal(x, y) );
+}
+
+TEST(FEniCSVectorAdapter,AllocationFreeComparison_ProductSpaceComponentWise)
+{
+    auto x = zero(V2D);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(x_.component(0)), std::vector<double>{1e6, 1e6, 1e6, 1e6});
+    FEniCS::setLocal(cast_ref<FEniCS::Vector>(x_.component(1)), std::vector<double>{1., 2., 3., 4.});
+    auto y = x;
+
+    // small relative to the whole vector, but not to its component
+    cast_ref<FEniCS::Vector>(cast_ref<ProductSpace::Vector>(y).component(1)).get().setitem(2, 3.5);
+    EXPECT_FALSE( FEniCS::equal(x, y) );
+    EXPECT_EQ( FEniCS::equal(x, y), x == y );
+}
+
+TEST(FEniCSVectorAdapter,SmallVector)
+{
+    ASSERT_TRUE( FEniCS::fitsSmallVector<>(V) );
+    auto v = get_test_vector(V, degrees_of_freedom);
+
+    Spacy::FEniCS::Vector w(v,V);
+    FEniCS::SmallVector<> x(w);
+    auto y = x;
+    y *= 2;
+    x += y;
+    x -= -y;
+
+    EXPECT_EQ( x.size(), degrees_of_freedom );
+    EXPECT_EQ( x[0], 0. );
+    EXPECT_EQ( x[1], 5. );
+    EXPECT_EQ( x(y), 10. );
+
+    x.copyTo(w);
+    EXPECT_EQ( w.get()[1], 5. );
+}
+
+TEST(FEniCSVectorAdapter,SmallVector_ExceedsCapacity)
+{
+    EXPECT_FALSE( FEniCS::fitsSmallVector<1>(V) );
+    EXPECT_THROW( FEniCS::SmallVector<1>(Spacy::FEniCS::Vector(V)), std::length_error );
+}
+
+TEST(FEniCSVectorAdapter,SmallVector_FromSpace)
+{
+    FEniCS::SmallVector<> x(V);
+    EXPECT_EQ( x.size(), degrees_of_freedom );
+    EXPECT_EQ( x[0], 0. );
+    EXPECT_EQ( x[degrees_of_freedom-1], 0. );
+    EXPECT_THROW( FEniCS::SmallVector<1>{V}, std::length_error );
+}
+
+TEST(FEniCSVectorAdapter,SmallVector_SizeMismatch)
+{
+    FEniCS::SmallVector<> x(V);
+    const FEniCS::SmallVector<> y(degrees_of_freedom+1);
+
+    EXPECT_THROW( x += y, std::invalid_argument );
+    EXPECT_THROW( x -= y, std::invalid_argument );
+    EXPECT_THROW( x(y), std::invalid_argument );
+}
+
+TEST(FEniCSVectorAdapter,BatchedDualPairings_ProductSpace)
+{
+    auto x = zero(V2D);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    for(auto j=0u; j<x_.numberOfVariables(); ++j)
+        FEniCS::setLocal(cast_ref<FEniCS::Vector>(x_.component(j)), std::vector<double>(4, j+1.));
+    std::vector<::Spacy::Vector> ys(2, x);
+    ys[1] *= 0.5;
+
+    const auto pairings = FEniCS::dualPairings(x, ys);
+
+    EXPECT_EQ( pairings[0], 4*(1. + 4. + 9.) );
+    EXPECT_EQ( pairings[1], 2*(1. + 4. + 9.) );
+    EXPECT_EQ( pairings[0], get(x(ys[0])) );
+}
+
+TEST(FEniCSVectorAdapter,VectorPool)
+{
+    FEniCS::VectorPool pool(V);
+    const dolfin::GenericVector* storage = nullptr;
+    {
+        auto v = pool.zero();
+        auto& v_ = cast_ref<FEniCS::Vector>(v.get());
+        storage = &v_.get();
+        FEniCS::setLocal(v_, std::vector<double>{1., 2.});
+    }
+    EXPECT_EQ( pool.misses(), 1u );
+    EXPECT_EQ( pool.size(), 1u );
+
+    auto w = pool.zero();
+    const auto& w_ = cast_ref<FEniCS::Vector>(w.get());
+    EXPECT_EQ( pool.hits(), 1u );
+    EXPECT_EQ( pool.size(), 0u );
+    EXPECT_EQ( &w_.get(), storage );
+    EXPECT_EQ( w_.get()[0], 0. );
+    EXPECT_EQ( w_.get()[1], 0. );
+}
+
+TEST(FEniCSVectorAdapter,VectorPool_ProductSpace)
+{
+    FEniCS::VectorPool pool(V2D);
+    {
+        auto x = pool.zero();
+        cast_ref<FEniCS::Vector>(cast_ref<ProductSpace::Vector>(x.get()).component(2)).get().setitem(1, 3.);
+    }
+
+    const auto misses = pool.misses();
+    auto y = pool.zero();
+    EXPECT_EQ( pool.misses(), misses );
+    EXPECT_EQ( cast_ref<FEniCS::Vector>(cast_ref<ProductSpace::Vector>(y.get()).component(2)).get()[1], 0. );
+}
+
+TEST(FEniCSVectorAdapter,VectorPool_Clear)
+{
+    FEniCS::VectorPool pool(V);
+    pool.zero();
+    EXPECT_EQ( pool.size(), 1u );
+
+    pool.clear();
+    EXPECT_EQ( pool.size(), 0u );
+    pool.zero();
+    EXPECT_EQ( pool.misses(), 2u );
+}
+
+TEST(FEniCSVectorAdapter,ComponentParallelOperations_ProductSpace)
+{
+    auto x = zero(V2D);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    for(auto j=0u; j<x_.numberOfVariables(); ++j)
+    {
+        std::vector<double> values(4);
+        std::iota(begin(values), end(values), 10.*j);
+        FEniCS::setLocal(cast_ref<FEniCS::Vector>(x_.component(j)), values);
+    }
+    auto y = x;
+    y *= 0.5;
+
+    auto expected = x;
+    expected += y;
+    expected *= 3;
+    expected -= y;
+
+    auto z = x;
+    FEniCS::add(z, y, 4);
+    FEniCS::scale(z, 3, 4);
+    FEniCS::subtract(z, y, 4);
+
+    EXPECT_EQ( z, expected );
+    EXPECT_EQ( FEniCS::dualPairing(z, x, 4), FEniCS::dualPairing(z, x, 1) );
+    EXPECT_DOUBLE_EQ( FEniCS::dualPairing(z, x, 4), get(z(x)) );
+}
+
+TEST(FEniCSVectorAdapter,ComponentParallelOperations_AboveThreshold)
+{
+    const auto largeMesh = std::make_shared<dolfin::UnitSquareMesh>(128, 128);
+    const auto X = Spacy::FEniCS::makeHilbertSpace(std::make_shared<L2Functional::CoefficientSpace_x>(largeMesh), {0,1,2}, {});
+    auto x = zero(X);
+    auto& x_ = cast_ref<ProductSpace::Vector>(x);
+    std::size_t size = 0;
+    for(auto j=0u; j<x_.numberOfVariables(); ++j)
+    {
+        auto& component = cast_ref<FEniCS::Vector>(x_.component(j));
+        std::vector<double> values(component.get().local_size());
+        for(auto i=0u; i<values.size(); ++i)
+            values[i] = std::sin(1. + i + j*values.size());
+        FEniCS::setLocal(component, values);
+        size += values.size();
+    }
+    ASSERT_EQ( FEniCS::numberOfThreadsFor(size, 4), 4u );
+    auto y = x;
+    y *= 0.5;
+
+    auto expected = x, z = x;
+    FEniCS::axpy(expected, 2., y, 1);
+    FEniCS::scale(expected, 3., 1);
+    FEniCS::axpy(z, 2., y, 4);
+    FEniCS::scale(z, 3., 4);
+
+    EXPECT_EQ( z, expected );
+    EXPECT_EQ( FEniCS::dualPairing(z, x, 4), FEniCS::dualPairing(z, x, 1) );
+}
+
+TEST(FEniCSVectorAdapter,ParallelFor)
+{
+    std::vector<int> visited(100, 0);
+    FEniCS::parallelFor(visited.size(), 8, [&visited](std::size_t i) { ++visited[i]; });
+
+    EXPECT_EQ( std::count(begin(visited), end(visited), 1), 100 );
+}
+
+TEST(FEniCSVectorAdapter,ParallelForReusesWorkersAndRethrows)
+{
+    const auto numberOfWorkers = FEniCS::ThreadPool::instance().numberOfWorkers();
+    std::atomic<int> calls{0};
+    const auto f = [&calls](std::size_t i)
+    {
+        ++calls;
+        if( i == 37 )
+            throw std::out_of_range("index 37");
+    };
+    EXPECT_THROW( FEniCS::parallelFor(100, 8, f), std::out_of_range );
+    EXPECT_GE( calls.load(), 1 );
+    EXPECT_EQ( FEniCS::ThreadPool::instance().numberOfWorkers(), numberOfWorkers );
+
+    // nested loops complete even if all workers are busy
+    std::vector<int> visited(64, 0);
+    FEniCS::parallelFor(8, 8, [&visited](std::size_t i)
+    {
+        FEniCS::parallelFor(8, 8, [&visited,i](std::size_t j) { ++visited[8*i + j]; });
+    });
+    EXPECT_EQ( std::count(begin(visited), end(visited), 1), 64 );
+}
@@ -5,8 +5,15 @@
 #include <Spacy/Spacy.h>
 #include <Spacy/Adapter/FEniCS/VectorSpace.h>
 
+#include "Dofmap.h"
 #include "LinearHeat.h"
 #include "L2Functional.h"
+#include "Renumbering.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <numeric>
+#include <vector>
 
 
 using namespace Spacy;
@@ -179,3 +186,248 @@ TEST(FEniCS,PrimalDualProductSpaceCreator_DofMap)
         EXPECT_EQ( P.inverseDofmap(i*number_of_variables+2), i );
     }
 }
+
+
+TEST(FEniCS,SingleSpaceCreator_AffineDofMap)
+{
+    const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(V1D));
+    ASSERT_TRUE( dofmap.isAffine() );
+    EXPECT_EQ( dofmap.size(), degrees_of_freedom );
+    EXPECT_EQ( dofmap.offset(), 0 );
+    EXPECT_EQ( dofmap.stride(), 1 );
+}
+
+TEST(FEniCS,ProductSpaceCreator_AffineDofMap)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    for(auto j=0; j<number_of_variables; ++j)
+    {
+        const auto& V = creator<FEniCS::VectorCreator>(X.subSpace(j));
+        const FEniCS::Dofmap dofmap(V);
+        ASSERT_TRUE( dofmap.isAffine() );
+        EXPECT_EQ( dofmap.offset(), j );
+        EXPECT_EQ( dofmap.stride(), number_of_variables );
+        for(auto i=0; i<degrees_of_freedom; ++i)
+        {
+            EXPECT_EQ( dofmap.dofmap(i), V.dofmap(i) );
+            EXPECT_EQ( dofmap.inverseDofmap(i*number_of_variables+j), V.inverseDofmap(i*number_of_variables+j) );
+        }
+    }
+}
+
+TEST(FEniCS,ProductSpaceCreator_AffineDofMap_PermutedSpace)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D_perm);
+    for(auto j=0; j<number_of_variables; ++j)
+    {
+        const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(X.subSpace(X.idMap(j))));
+        ASSERT_TRUE( dofmap.isAffine() );
+        EXPECT_EQ( dofmap.offset(), j );
+        EXPECT_EQ( dofmap.stride(), number_of_variables );
+    }
+}
+
+TEST(FEniCS,PrimalDualProductSpaceCreator_AffineDofMap)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2DPrimalDual);
+    const auto& X_primal = creator<ProductSpace::VectorCreator>(X.subSpace(0));
+    const auto& X_dual = creator<ProductSpace::VectorCreator>(X.subSpace(1));
+    const FEniCS::Dofmap Y(creator<FEniCS::VectorCreator>(X_primal.subSpace(0)));
+    const FEniCS::Dofmap U(creator<FEniCS::VectorCreator>(X_primal.subSpace(1)));
+    const FEniCS::Dofmap P(creator<FEniCS::VectorCreator>(X_dual.subSpace(0)));
+
+    ASSERT_TRUE( Y.isAffine() );
+    ASSERT_TRUE( U.isAffine() );
+    ASSERT_TRUE( P.isAffine() );
+    for(auto i=0; i<degrees_of_freedom; ++i)
+    {
+        EXPECT_EQ( Y.dofmap(i), i*number_of_variables );
+        EXPECT_EQ( U.dofmap(i), i*number_of_variables+1 );
+        EXPECT_EQ( P.dofmap(i), i*number_of_variables+2 );
+        EXPECT_EQ( P.inverseDofmap(i*number_of_variables+2), i );
+    }
+}
+
+TEST(FEniCS,GeneralDofMap)
+{
+    const FEniCS::Dofmap dofmap(std::vector<std::size_t>{4,0,7,2});
+    ASSERT_FALSE( dofmap.isAffine() );
+    EXPECT_EQ( dofmap.dofmap(0), 4 );
+    EXPECT_EQ( dofmap.dofmap(2), 7 );
+    EXPECT_EQ( dofmap.inverseDofmap(7), 2 );
+    EXPECT_EQ( dofmap.inverseDofmap(2), 3 );
+}
+
+TEST(FEniCS,ProductSpaceCreator_BatchedDofMap)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    const auto& U = creator<FEniCS::VectorCreator>(X.subSpace(1));
+    const FEniCS::Dofmap dofmap(U);
+
+    std::vector<std::size_t> in = {3,0,2,1}, out(in.size()), inverse(in.size());
+    dofmap.dofmap(in.data(), out.data(), in.size());
+    dofmap.inverseDofmap(out.data(), inverse.data(), out.size());
+    for(auto k=0u; k<in.size(); ++k)
+    {
+        EXPECT_EQ( out[k], U.dofmap(in[k]) );
+        EXPECT_EQ( inverse[k], in[k] );
+    }
+}
+
+TEST(FEniCS,GeneralDofMap_Batched)
+{
+    const FEniCS::Dofmap dofmap(std::vector<std::size_t>{4,0,7,2});
+    std::vector<std::size_t> in = {2,3}, out(2);
+    dofmap.dofmap(in.data(), out.data(), in.size());
+    EXPECT_EQ( out[0], 7 );
+    EXPECT_EQ( out[1], 2 );
+    dofmap.inverseDofmap(out.data(), in.data(), out.size());
+    EXPECT_EQ( in[0], 2 );
+    EXPECT_EQ( in[1], 3 );
+}
+
+TEST(FEniCS,DofMap_ScatterGather)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(X.subSpace(2)));
+    const FEniCS::Dofmap general(std::vector<std::size_t>{11,2,8,5});
+
+    std::vector<double> values = {1,2,3,4}, mixed(degrees_of_freedom*number_of_variables, 0), result(degrees_of_freedom);
+    dofmap.scatter(values.data(), mixed.data());
+    for(auto i=0; i<degrees_of_freedom; ++i)
+        EXPECT_EQ( mixed[i*number_of_variables+2], values[i] );
+
+    general.gather(mixed.data(), result.data());
+    EXPECT_EQ( result[0], 4 );
+    EXPECT_EQ( result[1], 1 );
+    EXPECT_EQ( result[2], 3 );
+    EXPECT_EQ( result[3], 2 );
+}
+
+TEST(FEniCS,DofMap_MemoryUsage)
+{
+    const FEniCS::Dofmap affine(creator<FEniCS::VectorCreator>(V1D));
+    EXPECT_EQ( affine.memoryUsage(), sizeof(FEniCS::Dofmap) );
+
+    const FEniCS::Dofmap general(std::vector<std::size_t>{10,4,7,13});
+    EXPECT_GE( general.memoryUsage(), sizeof(FEniCS::Dofmap) + (4 + 10)*sizeof(std::size_t) );
+}
+
+TEST(FEniCS,GeneralDofMap_InverseOutOfRange)
+{
+    const FEniCS::Dofmap dofmap(std::vector<std::size_t>{10,4,7,13});
+    EXPECT_EQ( dofmap.inverseDofmap(4), 1 );
+    EXPECT_EQ( dofmap.inverseDofmap(13), 3 );
+    EXPECT_THROW( dofmap.inverseDofmap(3), std::out_of_range );
+    EXPECT_THROW( dofmap.inverseDofmap(5), std::out_of_range );
+    EXPECT_THROW( dofmap.inverseDofmap(14), std::out_of_range );
+}
+
+TEST(FEniCS,AffineDofMap_InverseOutOfRange)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(X.subSpace(1)));
+    ASSERT_TRUE( dofmap.isAffine() );
+    EXPECT_EQ( dofmap.inverseDofmap(1), 0 );
+    EXPECT_EQ( dofmap.inverseDofmap((degrees_of_freedom-1)*number_of_variables+1), degrees_of_freedom-1 );
+    EXPECT_THROW( dofmap.inverseDofmap(0), std::out_of_range );
+    EXPECT_THROW( dofmap.inverseDofmap(2), std::out_of_range );
+    EXPECT_THROW( dofmap.inverseDofmap(degrees_of_freedom*number_of_variables+1), std::out_of_range );
+
+    std::vector<std::size_t> in = {1,3}, out(in.size());
+    EXPECT_THROW( dofmap.inverseDofmap(in.data(), out.data(), in.size()), std::out_of_range );
+}
+
+namespace
+{
+    std::size_t bandwidth(const dolfin::FunctionSpace& V, const std::vector<std::size_t>& ordering)
+    {
+        std::vector<std::size_t> position(ordering.size());
+        for(auto k=0u; k<ordering.size(); ++k)
+            position[ordering[k]] = k;
+
+        std::size_t result = 0;
+        for(auto c=0u; c<V.mesh()->num_cells(); ++c)
+        {
+            const auto dofs = V.dofmap()->cell_dofs(c);
+            for(auto k=0; k<dofs.size(); ++k)
+                for(auto l=0; l<dofs.size(); ++l)
+                    result = std::max<std::size_t>(result, std::abs(long(position[dofs[k]]) - long(position[dofs[l]])));
+        }
+        return result;
+    }
+}
+
+TEST(FEniCS,ReverseCuthillMcKee)
+{
+    const auto mesh = std::make_shared<dolfin::UnitSquareMesh>(8, 8);
+    const auto V = std::make_shared<L2Functional::CoefficientSpace_x>(mesh);
+    const auto ordering = FEniCS::reverseCuthillMcKee(*V);
+
+    auto sorted = ordering;
+    std::sort(begin(sorted), end(sorted));
+    std::vector<std::size_t> identity(V->dim());
+    std::iota(begin(identity), end(identity), std::size_t(0));
+    EXPECT_EQ( sorted, identity );
+    EXPECT_LE( bandwidth(*V, ordering), bandwidth(*V, identity) );
+}
+
+TEST(FEniCS,ReverseCuthillMcKee_Graph)
+{
+    // path 0 - 3 - 1 - 4 - 2
+    const std::vector<std::vector<std::size_t>> graph = { {3}, {3,4}, {4}, {0,1}, {1,2} };
+    const auto ordering = FEniCS::reverseCuthillMcKee(graph);
+
+    ASSERT_EQ( ordering.size(), graph.size() );
+    std::vector<std::size_t> position(ordering.size());
+    for(auto k=0u; k<ordering.size(); ++k)
+        position[ordering[k]] = k;
+    for(auto node=0u; node<graph.size(); ++node)
+        for(auto neighbour : graph[node])
+            EXPECT_EQ( std::abs(long(position[node]) - long(position[neighbour])), 1 );
+}
+
+TEST(FEniCS,RenumberedDofMap)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    const auto ordering = FEniCS::reverseCuthillMcKee(*dolfin_V2D);
+    for(auto j=0; j<number_of_variables; ++j)
+    {
+        const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(X.subSpace(j)));
+        const auto subOrdering = FEniCS::restrictOrdering(ordering, dofmap);
+        const auto renumbered = FEniCS::renumber(dofmap, subOrdering);
+
+        ASSERT_EQ( renumbered.size(), degrees_of_freedom );
+        for(auto i=0; i<degrees_of_freedom; ++i)
+        {
+            EXPECT_EQ( renumbered.dofmap(i), dofmap.dofmap(subOrdering[i]) );
+            EXPECT_EQ( renumbered.inverseDofmap(renumbered.dofmap(i)), i );
+        }
+        for(auto i=1; i<degrees_of_freedom; ++i)
+        {
+            const auto previous = std::find(begin(ordering), end(ordering), renumbered.dofmap(i-1));
+            const auto current = std::find(begin(ordering), end(ordering), renumbered.dofmap(i));
+            EXPECT_LT( previous, current );
+        }
+    }
+}
+
+TEST(FEniCS,RenumberedDofMap_PermutedValues)
+{
+    const auto& X = creator<ProductSpace::VectorCreator>(V2D);
+    const auto ordering = FEniCS::reverseCuthillMcKee(*dolfin_V2D);
+    const FEniCS::Dofmap dofmap(creator<FEniCS::VectorCreator>(X.subSpace(1)));
+    const auto subOrdering = FEniCS::restrictOrdering(ordering, dofmap);
+    const auto renumbered = FEniCS::renumber(dofmap, subOrdering);
+
+    std::vector<double> values = {1,2,3,4}, permuted(degrees_of_freedom), result(degrees_of_freedom);
+    std::vector<double> mixed(degrees_of_freedom*number_of_variables, 0), expected(mixed);
+    dofmap.scatter(values.data(), expected.data());
+    FEniCS::permute(subOrdering, values.data(), permuted.data());
+    renumbered.scatter(permuted.data(), mixed.data());
+    EXPECT_EQ( mixed, expected );
+
+    renumbered.gather(mixed.data(), permuted.data());
+    FEniCS::inversePermute(subOrdering, permuted.data(), result.data());
+    EXPECT_EQ( result, values );
+}
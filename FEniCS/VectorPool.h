@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <Spacy/Spacy.h>
+#include <Spacy/Adapter/FEniCS/Vector.h>
+
+#include "LocalArray.h"
+
+namespace Spacy
+{
+  namespace FEniCS
+  {
+    namespace Detail
+    {
+      /// Sets all process-local entries of the FEniCS vectors in x to zero, without going through dolfin.
+      inline void setZero(::Spacy::Vector& x)
+      {
+        if( is<ProductSpace::Vector>(x) )
+        {
+          auto& x_ = cast_ref<ProductSpace::Vector>(x);
+          for(auto k=0u; k<x_.numberOfVariables(); ++k)
+            setZero(x_.component(k));
+          return;
+        }
+        LocalArray array(cast_ref<Vector>(x).get());
+        std::fill(array.data(), array.data() + array.size(), 0.);
+      }
+    }
+
+    /**
+     * @brief Recycles vectors of a space, such that repeated temporaries do not create new PETSc vectors.
+     *
+     * zero() hands out a zero vector, reusing storage that has been given back by a previous Handle if possible.
+     *
+     * The pool owns the PETSc vectors held for reuse, so it must be owned by the caller and be destroyed or cleared
+     * before PETSc is finalized. Handles must not outlive their pool.
+     */
+    class VectorPool
+    {
+    public:
+      /// Vector from the pool, returned to the pool on destruction.
+      class Handle
+      {
+      public:
+        Handle(VectorPool& pool, ::Spacy::Vector v)
+          : pool_(&pool), v_(std::move(v))
+        {}
+
+        Handle(Handle&& other)
+          : pool_(other.pool_), v_(std::move(other.v_))
+        {
+          other.pool_ = nullptr;
+        }
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+        Handle& operator=(Handle&&) = delete;
+
+        ~Handle()
+        {
+          if( pool_ )
+            pool_->release(std::move(v_));
+        }
+
+        ::Spacy::Vector& get()
+        {
+          return v_;
+        }
+
+        const ::Spacy::Vector& get() const
+        {
+          return v_;
+        }
+
+        operator ::Spacy::Vector&()
+        {
+          return v_;
+        }
+
+      private:
+        VectorPool* pool_;
+        ::Spacy::Vector v_;
+      };
+
+      explicit VectorPool(const VectorSpace& V)
+        : V_(&V)
+      {}
+
+      Handle zero()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          if( !free_.empty() )
+          {
+            auto v = std::move(free_.back());
+            free_.pop_back();
+            ++hits_;
+            Detail::setZero(v);
+            return Handle(*this, std::move(v));
+          }
+        }
+        ++misses_;
+        return Handle(*this, ::Spacy::zero(*V_));
+      }
+
+      /// Number of calls to zero() that reused storage.
+      std::size_t hits() const
+      {
+        return hits_;
+      }
+
+      /// Number of calls to zero() that created a new vector.
+      std::size_t misses() const
+      {
+        return misses_;
+      }
+
+      /// Number of vectors currently held for reuse.
+      std::size_t size() const
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+      }
+
+      /// Destroys all vectors held for reuse.
+      void clear()
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.clear();
+      }
+
+    private:
+      void release(::Spacy::Vector v)
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(std::move(v));
+      }
+
+      const VectorSpace* V_;
+      mutable std::mutex mutex_;
+      std::vector<::Spacy::Vector> free_;
+      std::atomic<std::size_t> hits_{0};
+      std::atomic<std::size_t> misses_{0};
+    };
+  }
+}